@@ -21,10 +21,47 @@ proc nvhls::usercmd_post_assembly {} {
 
  #  directive set /$TOP_NAME/run/while -PIPELINE_INIT_INTERVAL 2
     # Set pipeline initialization interval for loops
-    directive set /$TOP_NAME/run/while -PIPELINE_STALL_MODE flush
+    # load, compute and store run concurrently (dataflow)
+    foreach proc {load compute store} {
+        directive set /$TOP_NAME/$proc/while -PIPELINE_INIT_INTERVAL 1
+        directive set /$TOP_NAME/$proc/while -PIPELINE_STALL_MODE flush
+    }
 
-    # Add loop unrolling for FIR computation
-    directive set /$TOP_NAME/run/optimize1 -UNROLL 16
+    # Loops compiled out by the FIR_* instantiation (exported by the
+    # Makefile) get no directives
+    set arch $::env(FIR_ARCH)
+    set fold $::env(FIR_FOLD)
+    set max_rate $::env(FIR_MAX_RATE)
+
+    if {$arch == 0} {
+        # Add loop unrolling for FIR computation
+        # Fully unroll so the factor follows the FIR_TAPS instantiation
+        if {$fold} {
+            directive set /$TOP_NAME/compute/fold -UNROLL yes
+        } else {
+            directive set /$TOP_NAME/compute/optimize1 -UNROLL yes
+        }
+        # One optimize2 iteration produces FIR_LANES outputs
+        directive set /$TOP_NAME/compute/lanes -UNROLL yes
+        # Decimation filters the kept outputs of a word side by side;
+        # interpolation takes one input sample per interpolate iteration
+        # and evaluates its polyphase branches side by side
+        if {$max_rate > 1} {
+            directive set /$TOP_NAME/compute/decimate -UNROLL yes
+            directive set /$TOP_NAME/compute/interpolate -PIPELINE_INIT_INTERVAL 1
+            directive set /$TOP_NAME/compute/phases -UNROLL yes
+            directive set /$TOP_NAME/compute/polyphase -UNROLL yes
+        }
+    } else {
+        # Transposed form (FIR_ARCH=1): one sample per optimize_transposed
+        # iteration, every tap of the partial-sum chain updated in parallel
+        directive set /$TOP_NAME/compute/optimize_transposed -PIPELINE_INIT_INTERVAL 1
+        directive set /$TOP_NAME/compute/transposed_taps -UNROLL yes
+        if {$max_rate > 1} {
+            directive set /$TOP_NAME/compute/transposed_shift_taps -UNROLL yes
+            directive set /$TOP_NAME/compute/transposed_zeros -UNROLL yes
+        }
+    }
    # directive set /$TOP_NAME/run/optimize2 -PIPELINE_INIT_INTERVAL 2
 
     # Partition arrays to remove memory bottlenecks
@@ -1,7 +1,20 @@
-import re, os, sys
+import re, os, sys, csv
 
 module=sys.argv[1]
 clk_per=sys.argv[2]
+# Optional label for the instantiation, e.g. Accelerator_t32_s16_b80
+variant=sys.argv[3] if len(sys.argv)>3 else module
+# 1 if the symmetric-coefficient folding mode was synthesized
+fold=sys.argv[4] if len(sys.argv)>4 else '0'
+
+# Most recent unfolded FUNC area for the same variant and clock, so a
+# folded run can be compared against it
+unfolded_func=None
+if fold=='1' and os.path.exists('results.csv'):
+  for row in csv.DictReader(open('results.csv')):
+    if row['module_name']==variant and row['clk_per']==clk_per \
+        and (row.get('fold') or '0')=='0':
+      unfolded_func=row['area_func']
 
 results=open('results.csv','a')
 
@@ -15,7 +28,7 @@ results.write(open('hls.begin').readlines()[0].strip()+',')
 # date__end
 results.write(open('hls').readlines()[0].strip()+',')
 # module_name
-results.write(module+',')
+results.write(variant+',')
 # clk_per
 results.write(clk_per+',')
 
@@ -45,9 +58,17 @@ for line in f:
     continue
 f.close()
 
-for cat in areaScores[:-1]:
+for cat in areaScores:
   results.write(areaScoreDict[cat]+',')
-results.write(areaScoreDict[cat]+'\n')
+
+# fold
+results.write(fold+',')
+# area_total
+results.write(str(round(sum(float(areaScoreDict[cat]) for cat in areaScores),3))+',')
+# func_vs_unfolded
+if unfolded_func and float(unfolded_func)>0:
+  results.write('%.3f' % (float(areaScoreDict['FUNC'])/float(unfolded_func)))
+results.write('\n')
 
 results.close()
 
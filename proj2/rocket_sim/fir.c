@@ -3,16 +3,58 @@
 #define TAPS 16
 #define TSTEP1 32
 #define TSTEP2 48
+#define CHANNELS 2 // Channels interleaved in the streaming test
+#define CHUNK 16   // Samples sent per channel before switching
+#define DECIM 4    // Decimation factor in the rate-change test
+#define INTERP 2   // Interpolation factor in the rate-change test
+#define INTERP_IN 16 // Input samples in the interpolation test
 
 #include "expected.inc"
 
+// DMA scatter-gather descriptor, see sc/dma.h
+struct dma_desc {
+    long long src;
+    long long dst;
+    long long len;
+    long long flags;
+    long long next;
+};
+#define DMA_DESC_LAST 0x1
+#define DMA_CTRL_ASYNC 0x1 // len/desc writes return at once, poll st
+#define DMA_CTRL_IRQ 0x2   // Raise the DMA interrupt when the transfer completes
+
+// Interrupt lines of the interrupt controller, see sc/intc.h.
+// Build with USE_IRQ=1 to wait for completion in the interrupt
+// controller instead of polling the status registers.
+#define IRQ_DMA 0x1
+#define IRQ_ACCEL 0x2
+
 // CLOBBER is a compiler barrier
 static void clobber() {
     asm volatile ("" : : : "memory");
 }
 
+// Fills one descriptor; a null next ends the chain
+static void set_desc(volatile struct dma_desc *d, volatile void *src, volatile void *dst,
+                     long long len, volatile struct dma_desc *next) {
+    d->src = (long)src & 0x1fffffff;
+    d->dst = (long)dst & 0x1fffffff;
+    d->len = len;
+    d->flags = next ? 0 : DMA_DESC_LAST;
+    d->next = (long)next & 0x1fffffff;
+}
+
+// Cycle counter of the CPU, used to time the rate-change modes
+static long rdcycle() {
+    long cycles;
+    asm volatile ("rdcycle %0" : "=r"(cycles));
+    return cycles;
+}
+
 int main(int argc, char* argv[]) {
-    int n, m;
+    int n, m, k;
+    long acc, start, cycles;
+    long polls = 0; // Status register reads spent waiting
     volatile short *coef = (short *)0x60004000;
     volatile short *input = (short *)0x60002000;
     volatile short *output = (short *)0x60001000;
@@ -35,11 +77,32 @@ int main(int argc, char* argv[]) {
     volatile long long **dma_sr = (volatile long long **)0x70000010;
     volatile long long **dma_dr = (volatile long long **)0x70000018;
     volatile long long *dma_len = (volatile long long *)0x70000020;
+    volatile long long *dma_desc = (volatile long long *)0x70000028;
+    volatile long long *dma_rows = (volatile long long *)0x70000038;
+    volatile long long *dma_sstride = (volatile long long *)0x70000040;
+    volatile long long *dma_dstride = (volatile long long *)0x70000048;
+    volatile long long *dma1_st = (volatile long long *)0x70000080; // DMA channel 1
+    volatile long long *dma1_ctrl = (volatile long long *)0x70000088;
+    volatile long long **dma1_sr = (volatile long long **)0x70000090;
+    volatile long long **dma1_dr = (volatile long long **)0x70000098;
+    volatile long long *dma1_len = (volatile long long *)0x700000a0;
+    volatile long long *intc_enable = (volatile long long *)0x70020008;
+    volatile long long *intc_clear = (volatile long long *)0x70020010;
+    volatile long long *intc_wait = (volatile long long *)0x70020018;
+
+#ifdef USE_IRQ
+    // Only the line being waited on is enabled.  The Accelerator
+    // raises IRQ_ACCEL again during later jobs, and an enabled stale
+    // pending bit would make every wait return at once.
+    *intc_clear = IRQ_DMA | IRQ_ACCEL;
+    *intc_enable = IRQ_ACCEL;
+#endif
     volatile long long *accel_st = (volatile long long *)0x70010000;
     volatile long long *accel_ctrl = (volatile long long *)0x70010008;
     volatile long long *accel_w = (volatile long long *)0x70010010;
     volatile long long *accel_x = (volatile long long *)0x70010030;
     volatile long long *accel_z = (volatile long long *)0x70010050;
+    volatile long long *accel_perf = (volatile long long *)0x70010020; // 6 counters
 
     *dma_sr = (volatile long long *)((long)input & 0x1fffffff);
     *dma_dr = (volatile long long *)((long)accel_x & 0x1fffffff);
@@ -84,6 +147,8 @@ int main(int argc, char* argv[]) {
         total_error += (error < 0) ? (-error) : error; // Absolute value
     }
 
+    // st reads 0x2 from the moment this write returns until the segment
+    // is done, so the poll below never sees a previous segment's 0x3
     *accel_ctrl = 2;
     //printf("cpu main accel_ctrl write/read long long test error: ");
     //printf("%d\n", 2 - *accel_st);
@@ -95,9 +160,19 @@ int main(int argc, char* argv[]) {
     *dma_dr = (volatile long long *)((long)output & 0x1fffffff);
     *dma_len = 64;
 
+#ifdef USE_IRQ
+    // The spike model has no interrupt input, so the read of the wait
+    // register stands in for wfi: it returns once the interrupt is pending
+    while (!(*intc_wait & IRQ_ACCEL)) {
+        polls++;
+    }
+    *intc_clear = IRQ_ACCEL;
+#else
     while (*accel_st != 3) {
         // Wait for it to be done
+        polls++;
     }
+#endif
 
     *accel_ctrl = 9;
 
@@ -111,14 +186,297 @@ int main(int argc, char* argv[]) {
     *dma_len = 32; // starts transfer
     clobber();
 
+    // The accelerator accumulates signed products at full width, so its
+    // output now matches the reference exactly
     total_error = 0;
-    // for (n = 0; n < (TSTEP1 + TSTEP2); n++) {
-    //     error = expected[n] - output[n]; // Error for this time-step
-    //     total_error += (error < 0) ? (-error) : error; // Absolute value
-    //     //printf("cpu main k: %d output: %d expected %d\n", n, output[n], expected[n]);
-    // }
+    for (n = 0; n < (TSTEP1 + TSTEP2); n++) {
+        error = expected[n] - output[n]; // Error for this time-step
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+        //printf("cpu main k: %d output: %d expected %d\n", n, output[n], expected[n]);
+    }
+
+    printf("cpu main FIR total error: %d\n", total_error);
+
+    // Multi-channel streaming: the first segment is filtered on two
+    // channels, interleaved in chunks of 16 samples.  Each channel keeps
+    // its own history inside the accelerator, so no history is re-sent
+    // when switching channels.
+    *accel_ctrl = 0x4; // Streaming mode, all channel histories cleared
+    for (n = 0; n < TSTEP1; n += CHUNK) {
+        for (m = 0; m < CHANNELS; m++) {
+            *accel_ctrl = 0x40 | m; // Select channel m
+            clobber();
+
+            *dma_sr = (volatile long long *)((long)(input + n) & 0x1fffffff);
+            *dma_dr = (volatile long long *)((long)accel_x & 0x1fffffff);
+            *dma_len = CHUNK * sizeof(short); // starts transfer
+            clobber();
+
+            *dma_sr = (volatile long long *)((long)accel_z & 0x1fffffff);
+            *dma_dr = (volatile long long *)((long)(output_buffer + m * TSTEP1 + n) & 0x1fffffff);
+            *dma_len = CHUNK * sizeof(short); // starts transfer
+            clobber();
+        }
+    }
+    *accel_ctrl = 0x5; // Back to block mode
+
+    total_error = 0;
+    for (m = 0; m < CHANNELS; m++) {
+        for (n = 0; n < TSTEP1; n++) {
+            error = expected[n] - output_buffer[m * TSTEP1 + n]; // Error for this time-step
+            total_error += (error < 0) ? (-error) : error; // Absolute value
+        }
+    }
+    printf("cpu main multi-channel FIR total error: %d\n", total_error);
+
+    // Full rate: the first segment streamed in and out at rate 1, timed
+    // as the reference for the decimation and interpolation runs below
+    // (the interpolation run returns as many outputs as this one)
+    *accel_ctrl = 0x4; // Streaming mode at full rate, history cleared
+    clobber();
+    start = rdcycle();
+
+    *dma_sr = (volatile long long *)((long)input & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)accel_x & 0x1fffffff);
+    *dma_len = TSTEP1 * sizeof(short); // starts transfer
+    clobber();
+
+    *dma_sr = (volatile long long *)((long)accel_z & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)output_buffer & 0x1fffffff);
+    *dma_len = TSTEP1 * sizeof(short); // starts transfer
+    clobber();
+
+    cycles = rdcycle() - start;
+    total_error = 0;
+    for (n = 0; n < TSTEP1; n++) {
+        error = expected[n] - output_buffer[n]; // Error for this time-step
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+    }
+    printf("cpu main full-rate total error: %d cycles: %ld\n", total_error, cycles);
+
+    // Decimation: only every DECIM-th output of the first segment is
+    // computed and returned, so the result is expected[0], expected[DECIM], ...
+    *accel_ctrl = 0x4; // Streaming mode at full rate, history cleared
+    *accel_ctrl = 0x80 | DECIM;
+    clobber();
+    start = rdcycle();
+
+    *dma_sr = (volatile long long *)((long)input & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)accel_x & 0x1fffffff);
+    *dma_len = TSTEP1 * sizeof(short); // starts transfer
+    clobber();
+
+    *dma_sr = (volatile long long *)((long)accel_z & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)output_buffer & 0x1fffffff);
+    *dma_len = TSTEP1 / DECIM * sizeof(short); // starts transfer
+    clobber();
+
+    cycles = rdcycle() - start;
+    total_error = 0;
+    for (n = 0; n < TSTEP1 / DECIM; n++) {
+        error = expected[n * DECIM] - output_buffer[n]; // Error for this time-step
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+    }
+    printf("cpu main decimate-by-%d total error: %d cycles: %ld\n", DECIM, total_error, cycles);
+
+    // Interpolation: the accelerator filters the input as if INTERP-1
+    // zeros followed every sample.  The reference is computed here the
+    // same way, keeping the low 16 bits of the sum like the accelerator.
+    *accel_ctrl = 0x4;
+    *accel_ctrl = 0xA0 | INTERP;
+    clobber();
+    start = rdcycle();
+
+    *dma_sr = (volatile long long *)((long)input & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)accel_x & 0x1fffffff);
+    *dma_len = INTERP_IN * sizeof(short); // starts transfer
+    clobber();
+
+    *dma_sr = (volatile long long *)((long)accel_z & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)output_buffer & 0x1fffffff);
+    *dma_len = INTERP_IN * INTERP * sizeof(short); // starts transfer
+    clobber();
+
+    cycles = rdcycle() - start;
+    *accel_ctrl = 0x5; // Back to block mode
+
+    total_error = 0;
+    for (n = 0; n < INTERP_IN * INTERP; n++) {
+        acc = 0;
+        for (k = 0; k < TAPS; k++) {
+            m = n - (TAPS - 1) + k; // Position in the zero-stuffed input
+            if (m >= 0 && m % INTERP == 0) {
+                acc += coef[k] * input[m / INTERP];
+            }
+        }
+        error = (short)acc - output_buffer[n]; // Error for this time-step
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+    }
+    printf("cpu main interpolate-by-%d total error: %d cycles: %ld\n", INTERP, total_error, cycles);
+
+    // Scatter-gather: the complete block job (input, coefficients,
+    // weight echo, both segment commands and both output drains) is
+    // queued as one descriptor chain and started with a single write.
+    // Segment commands are copied from memory to accel_ctrl like data.
+    volatile struct dma_desc *desc = (struct dma_desc *)0x60008000;
+    volatile long long *ctrl_words = (volatile long long *)0x60008100;
+    ctrl_words[0] = 2;
+    ctrl_words[1] = 9;
+    set_desc(&desc[0], input, accel_x, (TSTEP1 + TSTEP2) * sizeof(short), &desc[1]);
+    set_desc(&desc[1], coef, accel_w, 2 * TAPS * sizeof(short), &desc[2]);
+    set_desc(&desc[2], accel_z, output_buffer, 2 * TAPS * sizeof(short), &desc[3]);
+    set_desc(&desc[3], &ctrl_words[0], accel_ctrl, sizeof(long long), &desc[4]);
+    set_desc(&desc[4], accel_z, output_buffer, TSTEP1 * sizeof(short), &desc[5]);
+    set_desc(&desc[5], &ctrl_words[1], accel_ctrl, sizeof(long long), &desc[6]);
+    set_desc(&desc[6], accel_z, output_buffer + TSTEP1, TSTEP2 * sizeof(short), 0);
+    clobber();
+    start = rdcycle();
+
+    *dma_desc = (long)desc & 0x1fffffff; // starts the chain
+    clobber();
+
+    cycles = rdcycle() - start;
+    total_error = 0;
+    for (n = 0; n < (TSTEP1 + TSTEP2); n++) {
+        error = expected[n] - output_buffer[n]; // Error for this time-step
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+    }
+    printf("cpu main scatter-gather FIR total error: %d cycles: %ld\n", total_error, cycles);
+
+    // Two DMA channels: channel 1 copies the input block to a scratch
+    // area in the background while channel 0 streams the first segment
+    // through the accelerator.
+    volatile short *scratch = (short *)0x60009000;
+    *accel_ctrl = 0x4; // Streaming mode, history cleared
+    *dma1_ctrl = DMA_CTRL_ASYNC | DMA_CTRL_IRQ;
+    *dma1_sr = (volatile long long *)((long)input & 0x1fffffff);
+    *dma1_dr = (volatile long long *)((long)scratch & 0x1fffffff);
+    *dma1_len = (TSTEP1 + TSTEP2) * sizeof(short); // starts transfer, returns at once
+    clobber();
+
+    *dma_sr = (volatile long long *)((long)input & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)accel_x & 0x1fffffff);
+    *dma_len = TSTEP1 * sizeof(short); // starts transfer
+    clobber();
 
-    //  printf("cpu main FIR total error: %d\n", total_error);
+    *dma_sr = (volatile long long *)((long)accel_z & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)output_buffer & 0x1fffffff);
+    *dma_len = TSTEP1 * sizeof(short); // starts transfer
+    clobber();
+    *accel_ctrl = 0x5; // Back to block mode
+
+#ifdef USE_IRQ
+    *intc_enable = IRQ_DMA;
+    while (!(*intc_wait & IRQ_DMA)) {
+        polls++;
+    }
+    *intc_clear = IRQ_DMA;
+#else
+    while (*dma1_st != 0) {
+        // Wait for the background copy
+        polls++;
+    }
+#endif
+
+    total_error = 0;
+    for (n = 0; n < TSTEP1; n++) {
+        error = expected[n] - output_buffer[n]; // Error for this time-step
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+    }
+    for (n = 0; n < (TSTEP1 + TSTEP2); n++) {
+        error = input[n] - scratch[n];
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+    }
+    printf("cpu main two-channel DMA total error: %d\n", total_error);
+    printf("cpu main status polls: %ld\n", polls);
+
+    // Strided DMA: two channels interleaved sample by sample in one
+    // buffer (channel 1 is the negated input).  Each channel is gathered
+    // straight out of the interleaved buffer into accel_x and its
+    // results are scattered back interleaved, with no copy pass.
+    volatile short *interleaved = (short *)0x6000a000;
+    volatile short *interleaved_out = (short *)0x6000b000;
+    for (n = 0; n < TSTEP1; n++) {
+        interleaved[n * CHANNELS] = input[n];
+        interleaved[n * CHANNELS + 1] = -input[n];
+    }
+    *accel_ctrl = 0x4; // Streaming mode, all channel histories cleared
+    *dma_rows = TSTEP1; // One sample per row
+    for (m = 0; m < CHANNELS; m++) {
+        *accel_ctrl = 0x40 | m; // Select channel m
+        clobber();
+
+        *dma_sstride = CHANNELS * sizeof(short);
+        *dma_dstride = 0;
+        *dma_sr = (volatile long long *)((long)(interleaved + m) & 0x1fffffff);
+        *dma_dr = (volatile long long *)((long)accel_x & 0x1fffffff);
+        *dma_len = sizeof(short); // starts transfer
+        clobber();
+
+        *dma_sstride = 0;
+        *dma_dstride = CHANNELS * sizeof(short);
+        *dma_sr = (volatile long long *)((long)accel_z & 0x1fffffff);
+        *dma_dr = (volatile long long *)((long)(interleaved_out + m) & 0x1fffffff);
+        *dma_len = sizeof(short); // starts transfer
+        clobber();
+    }
+    *dma_rows = 0; // Back to contiguous transfers
+    *accel_ctrl = 0x5; // Back to block mode
+
+    total_error = 0;
+    for (n = 0; n < TSTEP1; n++) {
+        error = expected[n] - interleaved_out[n * CHANNELS];
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+        error = (short)-expected[n] - interleaved_out[n * CHANNELS + 1];
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+    }
+    printf("cpu main strided DMA total error: %d\n", total_error);
+
+    // Concurrent feed and drain: channel 1 starts draining accel_z in
+    // the background before channel 0 feeds the whole block to accel_x.
+    // The block is larger than the x and z FIFOs together, so this only
+    // completes because a read stalled on z no longer holds up x.
+    for (n = 0; n < (TSTEP1 + TSTEP2); n++)
+        output_buffer[n] = 0;
+    polls = 0;
+    *accel_ctrl = 0x7; // Zero the performance counters
+    *accel_ctrl = 0x4; // Streaming mode, all channel histories cleared
+    *accel_ctrl = 0x40; // Channel 0
+    *dma1_ctrl = DMA_CTRL_ASYNC | DMA_CTRL_IRQ;
+    *dma1_sr = (volatile long long *)((long)accel_z & 0x1fffffff);
+    *dma1_dr = (volatile long long *)((long)output_buffer & 0x1fffffff);
+    *dma1_len = (TSTEP1 + TSTEP2) * sizeof(short); // starts transfer, returns at once
+    clobber();
+
+    start = rdcycle();
+    *dma_sr = (volatile long long *)((long)input & 0x1fffffff);
+    *dma_dr = (volatile long long *)((long)accel_x & 0x1fffffff);
+    *dma_len = (TSTEP1 + TSTEP2) * sizeof(short); // starts transfer
+    clobber();
+
+#ifdef USE_IRQ
+    *intc_enable = IRQ_DMA;
+    while (!(*intc_wait & IRQ_DMA)) {
+        polls++;
+    }
+    *intc_clear = IRQ_DMA;
+#else
+    while (*dma1_st != 0) {
+        // Wait for the drain
+        polls++;
+    }
+#endif
+    cycles = rdcycle() - start;
+    *accel_ctrl = 0x5; // Back to block mode
+
+    total_error = 0;
+    for (n = 0; n < (TSTEP1 + TSTEP2); n++) {
+        error = expected[n] - output_buffer[n]; // Error for this time-step
+        total_error += (error < 0) ? (-error) : error; // Absolute value
+    }
+    printf("cpu main concurrent feed/drain total error: %d cycles: %ld polls: %ld\n", total_error, cycles, polls);
+    printf("cpu main accel busy: %lld z stall: %lld x idle: %lld words in: %lld out: %lld jobs: %lld\n",
+           accel_perf[0], accel_perf[1], accel_perf[2], accel_perf[3], accel_perf[4], accel_perf[5]);
 
     *accel_ctrl = (volatile long long)0x0f; // Exit
 
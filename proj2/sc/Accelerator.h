@@ -1,210 +1,922 @@
 // /*
-//  * 
+//  *
 //  */
 
 
-//Working dec6 time 6:20pm 
+//Working dec6 time 6:20pm
 #pragma once
 
 #include "nvhls_pch.h"
+#include <ac_fixed.h>
+
+// Compile-time selection of the synthesized instantiation.
+// These are normally set from the Makefiles (FIR_TAPS=32 etc.),
+// so a new size can be simulated or synthesized without editing
+// the kernel.
+#ifndef FIR_TAPS
+#define FIR_TAPS 16        // Taps per segment (8, 16, 32, 64, 128)
+#endif
+#ifndef FIR_SAMPLE_BITS
+#define FIR_SAMPLE_BITS 16 // Sample and coefficient width in bits
+#endif
+#ifndef FIR_BLOCK
+#define FIR_BLOCK 80       // Samples per block in block mode
+#endif
+#ifndef FIR_SEG1
+#define FIR_SEG1 32        // Samples in the first segment of a block
+#endif
+#ifndef FIR_LANES
+#define FIR_LANES 4        // Outputs computed per optimize2 iteration (divides FIR_BEAT_BITS/FIR_SAMPLE_BITS)
+#endif
+#ifndef FIR_FOLD
+#define FIR_FOLD 0         // 1 = symmetric (linear-phase) coefficients, half the multipliers
+#endif
+#ifndef FIR_ACC_BITS
+#define FIR_ACC_BITS 40    // Signed accumulator width
+#endif
+#ifndef FIR_OUT_MODE
+#define FIR_OUT_MODE 0     // Output conversion, one of the OUT_* modes below
+#endif
+#ifndef FIR_OUT_SHIFT
+#define FIR_OUT_SHIFT 0    // Fraction bits dropped from the accumulator (15 for Q15 weights)
+#endif
+#ifndef FIR_CHANNELS
+#define FIR_CHANNELS 4     // Independent delay lines sharing the same taps
+#endif
+#ifndef FIR_ARCH
+#define FIR_ARCH 0         // Datapath, one of the ARCH_* forms below
+#endif
+#ifndef FIR_MAX_RATE
+#define FIR_MAX_RATE 4     // Largest decimation/interpolation factor in streaming mode
+#endif
+#ifndef FIR_BEAT_BITS
+#define FIR_BEAT_BITS 64   // Width of the w_in, x_in and z_out words (64, 128 or 256)
+#endif
+
+// Control commands received on ctrl_in
+enum {
+    CTRL_SEG1       = 0x2, // Filter the first segment of the buffered block
+    CTRL_STREAM_ON  = 0x4, // Enter streaming mode with an empty history
+    CTRL_STREAM_OFF = 0x5, // Leave streaming mode, back to block mode
+    CTRL_SWAP       = 0x6, // Activate the weight bank loaded since the last swap
+    CTRL_PERF_CLEAR = 0x7, // Zero the performance counters
+    CTRL_SEG2       = 0x9, // Filter the second segment of the buffered block
+    CTRL_CHANNEL    = 0x40, // 0x40 | ch: following x_in words belong to channel ch
+    CTRL_DECIMATE   = 0x80, // 0x80 | M: keep every M-th streaming output (M = 1 is full rate)
+    CTRL_INTERPOLATE = 0xA0 // 0xA0 | L: L streaming outputs per input sample
+};
+
+// Data word type for a BEAT_BITS-wide channel: sc_uint holds at most
+// 64 bits, wider words are sc_biguint
+template <int BEAT_BITS, bool WIDE = (BEAT_BITS > 64)>
+struct AxiWord { typedef sc_uint<BEAT_BITS> type; };
+template <int BEAT_BITS>
+struct AxiWord<BEAT_BITS, true> { typedef sc_biguint<BEAT_BITS> type; };
+
+// Performance counters, one sc_out per counter.  TlmToConn maps
+// counter n to the read address 0x20 + 8 * n.
+enum {
+    PERF_BUSY      = 0, // Cycles compute spent filtering beats (a full result FIFO counts as z stall)
+    PERF_Z_STALL   = 1, // Cycles a z_out word waited for the consumer
+    PERF_X_IDLE    = 2, // Cycles load waited for x_in inside a block or stream
+    PERF_WORDS_IN  = 3, // x_in words received
+    PERF_WORDS_OUT = 4, // z_out words sent
+    PERF_JOBS      = 5, // Completed segments (st 0x3)
+    PERF_COUNTERS  = 6
+};
+
+// FIR datapath architecture
+enum {
+    ARCH_DIRECT     = 0, // Adder tree over a sample window, LANES outputs per optimize2 iteration
+    ARCH_TRANSPOSED = 1  // Partial-sum chain, one multiply-add deep, one sample per cycle
+};
 
-SC_MODULE(Accelerator) {
+// Conversion of the accumulator to an output sample.
+// Bit 0 selects rounding, bit 1 selects saturation.
+enum {
+    OUT_TRUNCATE  = 0, // Drop fraction bits, wrap on overflow
+    OUT_ROUND     = 1, // Round to nearest, wrap on overflow
+    OUT_SATURATE  = 2, // Drop fraction bits, clip on overflow
+    OUT_ROUND_SAT = 3  // Round to nearest, clip on overflow
+};
+
+/*
+ * The accelerator is split into three concurrent processes so that
+ * input handling, filtering and output handshaking overlap:
+ *
+ *   load    - pops ctrl_in, w_in and x_in.  In block mode it collects
+ *             x_in words into one of two block buffers and, on a
+ *             segment command, replays that segment to compute while
+ *             the next block fills the other buffer.  A segment
+ *             command on a block that is still arriving replays
+ *             each word as it arrives.  Everything else
+ *             (weights, commands, streaming words) is forwarded in
+ *             arrival order.
+ *   compute - owns the weights and the delay line, filters one word
+ *             per beat and hands results to store.
+ *   store   - drives z_out and st_out.  A FIFO between compute and
+ *             store absorbs z_out backpressure so it does not stall
+ *             the filter.
+ *
+ * Block mode is filtered through the same delay line as streaming
+ * mode: a segment command clears the history, which is equivalent to
+ * the zero samples before the start of each segment.
+ *
+ * Samples and weights are signed.  Products are summed exactly in an
+ * ACC_BITS-wide accumulator, which is then shifted right by OUT_SHIFT
+ * and converted to SAMPLE_BITS according to OUT_MODE.  The defaults
+ * (shift 0, truncate/wrap) reproduce expected.inc bit for bit.
+ *
+ * compute keeps one delay line per channel.  A channel command
+ * (ctrl 0x40 | ch) selects the history used by the following x_in
+ * words, so independent signals can be interleaved word by word
+ * without reloading weights or re-sending history.  Entering
+ * streaming mode clears every channel and selects channel 0.
+ *
+ * In streaming mode the filter can also change the sample rate.
+ * Decimation by M (ctrl 0x80 | M) only filters the outputs that are
+ * kept: the kept samples of a word are routed to a bank of DEC_LANES
+ * output filters, as many as a word keeps at M = 2, so discarded
+ * outputs have no multipliers.  Interpolation by L (ctrl 0xA0 | L)
+ * filters the input as if L-1 zeros followed every sample.  Each input
+ * sample takes one interpolate iteration, in which its L outputs are
+ * evaluated as polyphase branches of PHASE_TAPS taps, the longest
+ * branch any L needs, instead of multiplying zeros.  Outputs are packed
+ * into z_out words as they are produced, so a word in gives 1/M or L
+ * words out.  Entering streaming mode restores full rate.
+ *
+ * ARCH selects the datapath.  The direct form sums TAPS products in an
+ * adder tree whose depth grows with TAPS.  The transposed form keeps
+ * HISTORY partial sums instead of a sample window: every new sample is
+ * multiplied by all weights and added to the neighbouring partial sum,
+ * so the critical path is one multiply-add for any TAPS.  It filters
+ * one sample per optimize_transposed iteration and does not use LANES
+ * or FOLD.  Decimation still evaluates every partial sum but only
+ * returns the kept outputs; interpolation shifts the chain without
+ * multiplying for the implied zeros.
+ *
+ * Each process keeps the performance counters it can observe and
+ * drives them on its perf_* outputs: load counts input words and the
+ * cycles spent waiting for them, compute its busy cycles, and store
+ * z_out backpressure, output words and completed segments.  ctrl 0x7
+ * zeroes them in every process in command order.
+ *
+ * BEAT_BITS sets the width of the w_in, x_in and z_out words.  Every
+ * word carries BEAT_BITS/SAMPLE_BITS samples, so a wider beat filters
+ * more samples per word at the same II.
+ */
+template <int TAPS, int SAMPLE_BITS, int BLOCK, int SEG1, int LANES = 1, bool FOLD = false,
+          int ACC_BITS = 40, int OUT_MODE = OUT_TRUNCATE, int OUT_SHIFT = 0, int CHANNELS = 1,
+          int MAX_RATE = 1, int ARCH = ARCH_DIRECT, int BEAT_BITS = 64>
+class AcceleratorT : public sc_module {
 public:
     sc_in_clk clk;
     sc_in<bool> rst;
 
-    typedef sc_uint<64> AXI_DATA; // 64-bit AXI bus data type
+    typedef typename AxiWord<BEAT_BITS>::type AXI_DATA; // AXI bus data type
+    typedef ac_int<SAMPLE_BITS, true> Sample;
+    typedef ac_int<ACC_BITS, true> Acc;
+    // Beat kind (top 2 bits) and data word.  The kind does not fit next
+    // to a 64-bit word in an sc_uint, so the internal channels use ac_int,
+    // which stays fixed width for every BEAT_BITS instead of falling back
+    // to sc_biguint.
+    typedef ac_int<2 + BEAT_BITS, false> Beat;
+
+    static const int WORDS64 = BEAT_BITS / 64;       // 64-bit pieces per AXI word
+    static const int PACK = BEAT_BITS / SAMPLE_BITS; // Samples per AXI word
+    static const int SEG2 = BLOCK - SEG1;     // Samples in the second segment
+    static const int HISTORY = TAPS - 1;      // Samples kept between words
+    static const int BLOCK_WORDS = BLOCK / PACK;
+    static const int SEG1_WORDS = SEG1 / PACK;
+    static const int RESULT_DEPTH = 4;        // Words buffered between compute and store
+    static const int DEC_LANES = (PACK + 1) / 2; // Outputs kept from one word at M = 2, the most for any M
+    static const int PHASE_TAPS = (TAPS + 1) / 2; // Taps of the longest polyphase branch, at L = 2
+    // Delay-line slots rewritten per word when the word is shorter than
+    // the history.  Wider words refill the whole line, and the bound of
+    // 0 keeps window_update, whose single wraparound only covers
+    // PACK < HISTORY, out of those instantiations.
+    static const int DELAY_UPDATE = (PACK < HISTORY) ? PACK : 0;
+
+    static_assert(BEAT_BITS == 64 || BEAT_BITS == 128 || BEAT_BITS == 256, "BEAT_BITS must be 64, 128 or 256");
+    static_assert(64 % SAMPLE_BITS == 0, "SAMPLE_BITS must divide 64 bits");
+    static_assert(SEG1 % PACK == 0 && SEG2 % PACK == 0, "segments must be whole AXI words");
+    static_assert(PACK % LANES == 0, "LANES must divide the samples per AXI word");
+    static_assert(OUT_SHIFT < ACC_BITS, "OUT_SHIFT must leave integer bits in the accumulator");
+    static_assert(CHANNELS >= 1 && CHANNELS <= 64, "channel id is carried in ctrl bits 5:0");
+    static_assert(ARCH == ARCH_DIRECT || ARCH == ARCH_TRANSPOSED, "unknown ARCH");
+    static_assert(MAX_RATE >= 1 && MAX_RATE <= 31, "rate factor is carried in ctrl bits 4:0");
+
+    static const ac_q_mode OUT_Q = (OUT_MODE & OUT_ROUND) ? AC_RND : AC_TRN;
+    static const ac_o_mode OUT_O = (OUT_MODE & OUT_SATURATE) ? AC_SAT : AC_WRAP;
+
+    // Beat kinds on the load -> compute channel
+    enum { BEAT_X = 0, BEAT_W = 1, BEAT_CMD = 2 };
+    // Beat kinds on the compute -> store channel
+    enum { BEAT_DATA = 0, BEAT_STATUS = 1, BEAT_CLEAR = 2 };
+    // Streaming rate modes
+    enum { RATE_FULL = 0, RATE_DECIMATE = 1, RATE_INTERPOLATE = 2 };
+
+    typedef sc_uint<32> Count;
 
     sc_out<sc_uint<8>> st_out;
+    sc_out<Count> perf_busy;
+    sc_out<Count> perf_z_stall;
+    sc_out<Count> perf_x_idle;
+    sc_out<Count> perf_words_in;
+    sc_out<Count> perf_words_out;
+    sc_out<Count> perf_jobs;
     Connections::In<sc_uint<8>> ctrl_in;
-    Connections::In<sc_uint<64>> w_in;
-    Connections::In<sc_uint<64>> x_in;
-    Connections::Out<sc_uint<64>> z_out;
-
-    SC_HAS_PROCESS(Accelerator);
-
-    Accelerator(sc_module_name name_) : sc_module(name_),
-                                        st_out("st_out"),
-                                        ctrl_in("ctrl_in"),
-                                        w_in("w_in"),
-                                        x_in("x_in"),
-                                        z_out("z_out") {
-        SC_THREAD(run);
+    Connections::In<AXI_DATA> w_in;
+    Connections::In<AXI_DATA> x_in;
+    Connections::Out<AXI_DATA> z_out;
+
+    Connections::Combinational<Beat> load_to_compute{"load_to_compute"};
+    Connections::Combinational<Beat> compute_to_fifo{"compute_to_fifo"};
+    Connections::Combinational<Beat> fifo_to_store{"fifo_to_store"};
+    Connections::Fifo<Beat, RESULT_DEPTH> result_fifo{"result_fifo"};
+
+    SC_HAS_PROCESS(AcceleratorT);
+
+    AcceleratorT(sc_module_name name_) : sc_module(name_),
+                                         st_out("st_out"),
+                                         perf_busy("perf_busy"),
+                                         perf_z_stall("perf_z_stall"),
+                                         perf_x_idle("perf_x_idle"),
+                                         perf_words_in("perf_words_in"),
+                                         perf_words_out("perf_words_out"),
+                                         perf_jobs("perf_jobs"),
+                                         ctrl_in("ctrl_in"),
+                                         w_in("w_in"),
+                                         x_in("x_in"),
+                                         z_out("z_out") {
+        result_fifo.clk(clk);
+        result_fifo.rst(rst);
+        result_fifo.enq(compute_to_fifo);
+        result_fifo.deq(fifo_to_store);
+
+        SC_THREAD(load);
+        sensitive << clk.pos();
+        NVHLS_NEG_RESET_SIGNAL_IS(rst);
+
+        SC_THREAD(compute);
+        sensitive << clk.pos();
+        NVHLS_NEG_RESET_SIGNAL_IS(rst);
+
+        SC_THREAD(store);
         sensitive << clk.pos();
         NVHLS_NEG_RESET_SIGNAL_IS(rst);
     }
 
     // Helper function for packed output
-    AXI_DATA assign_packed_output(AXI_DATA current_packed, sc_uint<16> value, int index) {
+    AXI_DATA assign_packed_output(AXI_DATA current_packed, Sample value, int index) {
         #pragma HLS inline
-        current_packed.range(index * 16 + 15, index * 16) = value;
+        current_packed.range(index * SAMPLE_BITS + SAMPLE_BITS - 1, index * SAMPLE_BITS) = value.to_uint64();
         return current_packed;
     }
 
-    void run() {
+    static Beat make_beat(unsigned kind, AXI_DATA data) {
+        Beat beat = 0;
+        beat_pack: for (int i = 0; i < WORDS64; i++) {
+            #pragma HLS unroll
+            beat.set_slc(64 * i, ac_int<64, false>(data.range(64 * i + 63, 64 * i).to_uint64()));
+        }
+        beat.set_slc(BEAT_BITS, ac_int<2, false>(kind));
+        return beat;
+    }
+
+    static unsigned beat_kind(const Beat& beat) {
+        return beat.template slc<2>(BEAT_BITS).to_uint();
+    }
+
+    static AXI_DATA beat_data(const Beat& beat) {
+        AXI_DATA data = 0;
+        beat_unpack: for (int i = 0; i < WORDS64; i++) {
+            #pragma HLS unroll
+            data.range(64 * i + 63, 64 * i) = beat.template slc<64>(64 * i).to_uint64();
+        }
+        return data;
+    }
+
+    void load() {
         ctrl_in.Reset();
         w_in.Reset();
         x_in.Reset();
-        z_out.Reset();
-
-        AXI_DATA data = 0;
-        sc_uint<8> ctrl = 0;
+        load_to_compute.ResetWrite();
 
-// Buffer to store input samples
-// Size: 80
+// Buffers to store input words (two banks)
+// Size: 2 x BLOCK_WORDS (2 x 20 by default)
 // Reason: The FIR computations are divided into two segments:
-// - The first segment (`TSTEP1`) processes 32 input samples.
-// - The second segment (`TSTEP2`) processes 48 input samples.
-// Total input samples required: TSTEP1 + TSTEP2 = 32 + 48 = 80.
-// This buffer stores all input samples needed for both FIR computations.
-sc_uint<16> input_data_buffer[80];
-
-// Buffer to store filter weights
-// Size: 32
+// - The first segment (`SEG1`) processes the first SEG1 input samples (32 by default).
+// - The second segment (`SEG2`) processes the remaining BLOCK - SEG1 samples (48 by default).
+// One bank holds a complete block for both FIR computations while the
+// next block arrives in the other bank.
+AXI_DATA input_data_buffer[2][BLOCK_WORDS];
+
+        bool bank_full[2] = {false, false}; // Bank holds a block not yet retired
+        bool bank_new[2] = {false, false};  // Full bank whose first segment has not run
+        int fill_bank = 0;     // Bank written by x_in in block mode
+        int fill_index = 0;    // Word position in the fill bank
+        int ready_bank = 0;    // Most recently completed bank
+        int job_bank = 0;      // Bank used by the current block's segments
+        bool job_filling = false; // job_bank is the fill bank, still receiving x_in
+        bool streaming = false; // x_in words are forwarded on arrival when set
+
+        bool replaying = false; // A segment is being replayed to compute
+        bool replay_release = false; // Retire job_bank when the replay ends
+        int replay_index = 0;
+        int replay_end = 0;
+
+        Beat pending = 0;       // Command/weight/stream beat waiting for compute
+        bool pending_valid = false;
+
+        Count x_idle = 0;
+        Count words_in = 0;
+        perf_x_idle.write(0);
+        perf_words_in.write(0);
+
+        wait(); // Wait separates reset from operational behavior
+
+        while (1) {
+            #pragma HLS pipeline II=1
+            AXI_DATA data;
+            sc_uint<8> ctrl;
+            bool x_popped = false;
+
+            // Hand at most one beat per cycle to compute.  A queued beat
+            // goes first so a segment command precedes its samples.
+            if (pending_valid) {
+                if (load_to_compute.PushNB(pending)) {
+                    pending_valid = false;
+                }
+            } else if (replaying && (!job_filling || replay_index < fill_index)) {
+                // A job on the fill bank replays each word once it has arrived
+                if (load_to_compute.PushNB(make_beat(BEAT_X, input_data_buffer[job_bank][replay_index]))) {
+                    replay_index++;
+                    if (replay_index == replay_end) {
+                        replaying = false;
+                        if (replay_release) {
+                            bank_full[job_bank] = false;
+                        }
+                    }
+                }
+            }
+
+            // Block-mode samples are buffered while the other bank replays
+            bool fill_blocked = bank_full[fill_bank];
+            // Waiting for x_in: a block is partly received, or streaming
+            bool x_wanted = streaming || (!fill_blocked && fill_index != 0);
+            if (!streaming && !fill_blocked && x_in.PopNB(data)) {
+                x_popped = true;
+                input_data_buffer[fill_bank][fill_index++] = data;
+                if (fill_index == BLOCK_WORDS) {
+                    bank_full[fill_bank] = true;
+                    bank_new[fill_bank] = !job_filling;
+                    job_filling = false;
+                    ready_bank = fill_bank;
+                    fill_bank = 1 - fill_bank;
+                    fill_index = 0;
+                }
+            }
+
+            // Weights, streaming words and commands keep their arrival order.
+            // Commands wait for buffered x_in words so a segment command
+            // never overtakes the samples it refers to.
+            if (!pending_valid && !replaying) {
+                if (w_in.PopNB(data)) {
+                    pending = make_beat(BEAT_W, data);
+                    pending_valid = true;
+                } else if (streaming && x_in.PopNB(data)) {
+                    x_popped = true;
+                    pending = make_beat(BEAT_X, data);
+                    pending_valid = true;
+                } else if ((streaming || fill_blocked || x_in.Empty()) && ctrl_in.PopNB(ctrl)) {
+                    pending = make_beat(BEAT_CMD, ctrl);
+                    pending_valid = true;
+
+                    if (ctrl == CTRL_SEG1) {
+                        // The oldest complete block whose first segment has
+                        // not run, otherwise the block being received, so
+                        // ctrl 0x2 after only SEG1 samples filters those
+                        int bank;
+                        if (bank_new[1 - ready_bank]) {
+                            bank = 1 - ready_bank;
+                        } else if (bank_new[ready_bank] || fill_blocked) {
+                            bank = ready_bank;
+                        } else {
+                            bank = fill_bank;
+                        }
+                        // A newer block retires the previous one even if
+                        // its second segment was never requested
+                        if (job_bank != bank) {
+                            bank_full[job_bank] = false;
+                        }
+                        job_bank = bank;
+                        job_filling = !bank_full[bank];
+                        bank_new[bank] = false;
+                        replaying = true;
+                        replay_index = 0;
+                        replay_end = SEG1_WORDS;
+                        replay_release = false;
+                    } else if (ctrl == CTRL_SEG2) {
+                        replaying = true;
+                        replay_index = SEG1_WORDS;
+                        replay_end = BLOCK_WORDS;
+                        replay_release = true;
+                    } else if (ctrl == CTRL_STREAM_ON) {
+                        streaming = true;
+                        fill_index = 0;
+                        job_filling = false;
+                    } else if (ctrl == CTRL_STREAM_OFF) {
+                        streaming = false;
+                    } else if (ctrl == CTRL_PERF_CLEAR) {
+                        x_idle = 0;
+                        words_in = 0;
+                        perf_x_idle.write(0);
+                        perf_words_in.write(0);
+                    }
+                }
+            }
+
+            if (x_popped) {
+                words_in++;
+                perf_words_in.write(words_in);
+            } else if (x_wanted) {
+                x_idle++;
+                perf_x_idle.write(x_idle);
+            }
+            wait(); // Maintain timing and synchronization
+        }
+    }
+
+    void compute() {
+        load_to_compute.ResetRead();
+        compute_to_fifo.ResetWrite();
+
+// Buffers to store filter weights (two banks)
+// Size: 2 x 2 * TAPS (2 x 32 by default)
 // Reason: The FIR computations use two sets of weights:
-// - The first set (`TAPS1`) consists of 16 weights for the first computation segment.
-// - The second set (`TAPS2`) consists of another 16 weights for the second computation segment.
-// Total weights required: TAPS1 + TAPS2 = 16 + 16 = 32.
-// This buffer stores all filter weights needed for both FIR computations.
-sc_uint<16> weight_data_buffer[32];
-
-// Buffer to store computed output samples
-// Size: 80
-// Reason: The FIR computations produce output samples for each input segment:
-// - The first segment (`TSTEP1`) produces 32 output samples.
-// - The second segment (`TSTEP2`) produces 48 output samples.
-// Total output samples generated: TSTEP1 + TSTEP2 = 32 + 48 = 80.
-// This buffer stores all output samples generated by both FIR computations.
-sc_uint<16> output_data_buffer[80];
-
-        #pragma HLS array_partition variable=input_data_buffer cyclic factor=16 dim=1
-        #pragma HLS array_partition variable=weight_data_buffer complete dim=1
-        #pragma HLS array_partition variable=output_data_buffer cyclic factor=4 dim=1
-
-        const AXI_DATA LOWER_16BIT_MASK = 0xFFFF; // Mask to extract 16-bit data chunks
-
-        int input_index = 0;   // Tracks the position in the input buffer
+// - The first set consists of TAPS weights for the first computation segment.
+// - The second set consists of another TAPS weights for the second computation segment.
+// Each bank stores all filter weights needed for both FIR computations.
+// The computation reads `active_bank` while w_in writes `load_bank`.
+// Both start at bank 0, so without a swap command w_in overwrites the
+// active weights in place as before.  A swap (ctrl 0x6) activates the
+// bank that was just loaded and directs further w_in writes to the
+// other one, so new taps can be loaded while the filter keeps running.
+Sample weight_data_buffer[2][2 * TAPS];
+
+// Circular delay lines, one per channel
+// Size: CHANNELS x HISTORY (CHANNELS x 15 by default)
+// Reason: A TAPS-tap filter needs the TAPS-1 most recent samples in addition
+// to the current one.  The oldest sample sits at `delay_head`, so each
+// input word only overwrites PACK slots instead of shifting the line.
+// Only the selected channel's row is read per word, so the channel
+// dimension can stay in memory.
+Sample delay_line[CHANNELS][HISTORY];
+int delay_head[CHANNELS]; // Slot of the oldest sample in each delay line
+
+// Partial sums of the transposed form, one chain per channel
+// Size: CHANNELS x HISTORY (CHANNELS x 15 by default)
+// Reason: partial_sums[c][i] holds the contribution of past samples to the
+// output i+1 samples ahead, so an output needs a single multiply-add.
+// Only used when ARCH is ARCH_TRANSPOSED.
+Acc partial_sums[CHANNELS][HISTORY];
+
+// Rate-change state, one entry per channel
+// Reason: Decimated and interpolated outputs no longer line up with
+// input words, so each channel keeps its decimation phase (samples
+// until the next kept output) and the z_out word it is currently
+// packing.
+int rate_phase[CHANNELS];
+AXI_DATA out_word[CHANNELS];
+int out_count[CHANNELS];
+
+        #pragma HLS array_partition variable=weight_data_buffer complete dim=0
+        #pragma HLS array_partition variable=delay_line complete dim=2
+        #pragma HLS array_partition variable=partial_sums complete dim=2
+
         int weight_index = 0;  // Tracks the position in the weight buffer
+        int weight_offset = 0; // First weight of the current segment
+        int active_bank = 0;   // Weight bank read by the FIR computation
+        int load_bank = 0;     // Weight bank written by w_in
+        int channel = 0;       // Channel of the following x_in words
+        int job_words = 0;     // Words left in the current segment
+        bool streaming = false; // Rate modes only apply while streaming
+        int rate_mode = RATE_FULL;
+        int rate = 1;          // Decimation or interpolation factor
+
+        clear_channels: for (int c = 0; c < CHANNELS; c++) {
+            clear_delay_line(delay_line[c], delay_head[c], partial_sums[c]);
+            clear_rate_state(rate_phase[c], out_word[c], out_count[c]);
+        }
+
+        Count busy_cycles = 0; // PERF_BUSY
+        perf_busy.write(0);
 
-        st_out.write(ctrl);
         wait(); // Wait separates reset from operational behavior
 
         while (1) {
-            
-
-    //         if (!w_in.Empty()) {
-    //     data = w_in.Pop();
-
-    //     // Directly extract all four 16-bit chunks and assign them in one step
-    //     weight_data_buffer[weight_index++] = data.range(15, 0);     // Extract lower 16 bits
-    //     weight_data_buffer[weight_index++] = data.range(31, 16);    // Extract next 16 bits
-    //     weight_data_buffer[weight_index++] = data.range(47, 32);    // Extract third 16 bits
-    //     weight_data_buffer[weight_index++] = data.range(63, 48);    // Extract upper 16 bits
-
-    //     // Reset weight index when buffer is full
-    //     if (weight_index == 32) {
-    //         weight_index = 0;
-    //     }
-
-    //     // Push the original data for verification
-    //     z_out.Push(data);
-    // }
-    if (!w_in.Empty()) {
-    data = w_in.Pop();
-    #pragma HLS pipeline II=1
-
-    // Use a shift register approach for optimized extraction and assignment
-    sc_uint<16> extracted_values[4]; // Temporary storage for extracted chunks
-    #pragma HLS array_partition variable=extracted_values complete dim=1
-
-    // Extract 16-bit chunks in parallel
-    extracted_values[0] = data.range(15, 0);
-    extracted_values[1] = data.range(31, 16);
-    extracted_values[2] = data.range(47, 32);
-    extracted_values[3] = data.range(63, 48);
-
-    // Assign the extracted chunks to the weight buffer
-    for (int i = 0; i < 4; i++) {
-        #pragma HLS unroll
-        weight_data_buffer[weight_index++] = extracted_values[i];
-
-        // Reset weight index when buffer is full
-        if (weight_index == 32) {
-            weight_index = 0;
-        }
-    }
-
-    z_out.Push(data); // Push the original data for verification
-}
-            
-
-
-            else if (!x_in.Empty()) {
-    data = x_in.Pop();
-
-    // Unpack 16-bit chunks directly using range and parallel assignment
-    #pragma HLS pipeline II=1
-    input_data_buffer[input_index++] = data.range(15, 0);  // Extract bits 0-15
-    input_data_buffer[input_index++] = data.range(31, 16); // Extract bits 16-31
-    input_data_buffer[input_index++] = data.range(47, 32); // Extract bits 32-47
-    input_data_buffer[input_index++] = data.range(63, 48); // Extract bits 48-63
-
-    // Reset index if the buffer is full
-    if (input_index == 80) {
-        input_index = 0;
-    }
-}
-            // Process control signals
-            else if (!ctrl_in.Empty()) {
-                ctrl = ctrl_in.Pop();
-
-                if (ctrl == 0x2) { // Perform FIR computation for the first segment
-                    perform_fir(32, 0, output_data_buffer, weight_data_buffer, input_data_buffer, z_out);
-                    st_out.write(0x3); // Signal operation completion
-                } else if (ctrl == 0x9) { // Perform FIR computation for the second segment
-                    perform_fir(48, 32, output_data_buffer, &weight_data_buffer[16], &input_data_buffer[32], z_out);
+            #pragma HLS pipeline II=1
+            Beat beat = load_to_compute.Pop();
+            AXI_DATA data = beat_data(beat);
+            busy_cycles++; // Waiting in Pop is idle, the iteration that follows is busy
+
+            if (beat_kind(beat) == BEAT_W) {
+                // Assign the PACK chunks of the word to the weight buffer
+                unpack_weights: for (int i = 0; i < PACK; i++) {
+                    #pragma HLS unroll
+                    weight_data_buffer[load_bank][weight_index++] = unpack_sample(data, i);
+
+                    // Reset weight index when buffer is full
+                    if (weight_index == 2 * TAPS) {
+                        weight_index = 0;
+                    }
+                }
+
+                compute_to_fifo.Push(make_beat(BEAT_DATA, data)); // Push the original data for verification
+            } else if (beat_kind(beat) == BEAT_X) {
+                Sample* weights = &weight_data_buffer[active_bank][weight_offset];
+                int mode = streaming ? rate_mode : RATE_FULL;
+
+                if (ARCH == ARCH_TRANSPOSED) {
+                    optimize_transposed: for (int k = 0; k < PACK; k++) {
+                        #pragma HLS pipeline II=1
+                        Sample y = transposed_step(unpack_sample(data, k), partial_sums[channel], weights);
+                        if (mode != RATE_DECIMATE || rate_phase[channel] == 0) {
+                            emit_output(y, out_word[channel], out_count[channel]);
+                        }
+                        if (mode == RATE_DECIMATE) {
+                            rate_phase[channel] = (rate_phase[channel] == 0) ? rate - 1 : rate_phase[channel] - 1;
+                        }
+                        // Implied zeros between interpolated samples
+                        transposed_zeros: for (int p = 1; p < MAX_RATE; p++) {
+                            if (mode == RATE_INTERPOLATE && p < rate) {
+                                emit_output(transposed_shift(partial_sums[channel]), out_word[channel], out_count[channel]);
+                            }
+                        }
+                    }
+                } else {
+                    Sample window[HISTORY + PACK]; // Oldest history sample first, newest input last
+                    #pragma HLS array_partition variable=window complete dim=1
+                    load_window(data, delay_line[channel], delay_head[channel], window);
+
+                    if (mode == RATE_FULL) {
+                        compute_to_fifo.Push(make_beat(BEAT_DATA, filter_word(window, weights)));
+                    } else if (mode == RATE_DECIMATE) {
+                        // Lane j filters the j-th kept sample of the word,
+                        // which sits rate samples after the previous one
+                        int next = rate_phase[channel];
+                        decimate: for (int j = 0; j < DEC_LANES; j++) {
+                            #pragma HLS unroll
+                            if (next < PACK) {
+                                emit_output(fir_output(&window[next], weights), out_word[channel], out_count[channel]);
+                                next += rate;
+                            }
+                        }
+                        rate_phase[channel] = next - PACK;
+                    } else {
+                        interpolate: for (int k = 0; k < PACK; k++) {
+                            #pragma HLS pipeline II=1
+                            phases: for (int p = 0; p < MAX_RATE; p++) {
+                                #pragma HLS unroll
+                                if (p < rate) {
+                                    emit_output(fir_phase(&window[k], weights, p, rate), out_word[channel], out_count[channel]);
+                                }
+                            }
+                        }
+                    }
+
+                    advance_delay_line(delay_line[channel], delay_head[channel], window);
+                }
+
+                // The pipelined inner loops take a cycle per iteration:
+                // one per sample in the transposed form and when
+                // interpolating, one per LANES outputs of filter_word
+                if (ARCH == ARCH_TRANSPOSED || mode == RATE_INTERPOLATE) {
+                    busy_cycles += PACK - 1;
+                } else if (mode == RATE_FULL) {
+                    busy_cycles += PACK / LANES - 1;
+                }
+
+                if (job_words > 0) {
+                    job_words--;
+                    if (job_words == 0) {
+                        compute_to_fifo.Push(make_beat(BEAT_STATUS, 0x3)); // Signal segment completion
+                    }
+                }
+            } else {
+                sc_uint<8> ctrl = data.range(7, 0);
+
+                if (ctrl == CTRL_SEG1) { // Perform FIR computation for the first segment
+                    clear_delay_line(delay_line[channel], delay_head[channel], partial_sums[channel]);
+                    clear_rate_state(rate_phase[channel], out_word[channel], out_count[channel]);
+                    weight_offset = 0;
+                    job_words = SEG1_WORDS;
+                    compute_to_fifo.Push(make_beat(BEAT_STATUS, 0x2)); // Segment running until st returns to 0x3
+                } else if (ctrl == CTRL_SEG2) { // Perform FIR computation for the second segment
+                    clear_delay_line(delay_line[channel], delay_head[channel], partial_sums[channel]);
+                    clear_rate_state(rate_phase[channel], out_word[channel], out_count[channel]);
+                    weight_offset = TAPS;
+                    job_words = BLOCK_WORDS - SEG1_WORDS;
+                    compute_to_fifo.Push(make_beat(BEAT_STATUS, 0x2));
+                } else if (ctrl == CTRL_STREAM_ON) {
+                    clear_stream: for (int c = 0; c < CHANNELS; c++) {
+                        clear_delay_line(delay_line[c], delay_head[c], partial_sums[c]);
+                        clear_rate_state(rate_phase[c], out_word[c], out_count[c]);
+                    }
+                    streaming = true;
+                    rate_mode = RATE_FULL;
+                    rate = 1;
+                    channel = 0;
+                    weight_offset = 0;
+                    job_words = 0;
+                    compute_to_fifo.Push(make_beat(BEAT_STATUS, 0x4)); // Signal that the filter is free-running
+                } else if (ctrl == CTRL_STREAM_OFF) {
+                    streaming = false;
+                    compute_to_fifo.Push(make_beat(BEAT_STATUS, 0x0));
+                } else if (ctrl == CTRL_PERF_CLEAR) { // store clears its counters in order
+                    compute_to_fifo.Push(make_beat(BEAT_CLEAR, 0));
+                    busy_cycles = 0;
+                } else if (ctrl == CTRL_SWAP) { // Swap weight banks between blocks/words
+                    active_bank = load_bank;
+                    load_bank = 1 - load_bank;
+                    weight_index = 0;
+                } else if ((ctrl & 0xC0) == CTRL_CHANNEL) { // Select the channel history
+                    if ((ctrl & 0x3F) < CHANNELS) {
+                        channel = ctrl & 0x3F;
+                    }
+                } else if ((ctrl & 0xE0) == CTRL_DECIMATE || (ctrl & 0xE0) == CTRL_INTERPOLATE) {
+                    // Factors outside 1..MAX_RATE are ignored.  Changing the
+                    // rate restarts the phase and drops partly packed words.
+                    int factor = ctrl & 0x1F;
+                    if (factor >= 1 && factor <= MAX_RATE) {
+                        rate = factor;
+                        if (factor == 1) {
+                            rate_mode = RATE_FULL;
+                        } else if ((ctrl & 0xE0) == CTRL_DECIMATE) {
+                            rate_mode = RATE_DECIMATE;
+                        } else {
+                            rate_mode = RATE_INTERPOLATE;
+                        }
+                        clear_rate: for (int c = 0; c < CHANNELS; c++) {
+                            clear_rate_state(rate_phase[c], out_word[c], out_count[c]);
+                        }
+                    }
                 }
             }
+            perf_busy.write(busy_cycles);
             wait(); // Maintain timing and synchronization
         }
     }
 
-private:
-    void perform_fir(int compute_count, int output_offset,
-                     sc_uint<16>* output_data_buffer,
-                     sc_uint<16>* weight_data_buffer,
-                     sc_uint<16>* input_data_buffer,
-                     Connections::Out<AXI_DATA>& z_out) {
-        #pragma HLS pipeline II=1
-        int pack_index = 0;
-        AXI_DATA packed_output = 0;
+    void store() {
+        fifo_to_store.ResetRead();
+        z_out.Reset();
+
+        AXI_DATA out_data = 0;  // z_out word waiting for the consumer
+        bool out_valid = false;
+        Count z_stall = 0;
+        Count words_out = 0;
+        Count jobs = 0;
+
+        st_out.write(0);
+        perf_z_stall.write(0);
+        perf_words_out.write(0);
+        perf_jobs.write(0);
+        wait(); // Wait separates reset from operational behavior
 
-        optimize2: for (int n = 0; n < compute_count; n++) {
+        while (1) {
             #pragma HLS pipeline II=1
-            output_data_buffer[output_offset + n] = 0;
+            Beat beat;
+
+            // A word is offered until z_out takes it; the next beat is
+            // popped in the same cycle, so words still go out one per cycle
+            if (out_valid) {
+                if (z_out.PushNB(out_data)) {
+                    out_valid = false;
+                    words_out++;
+                    perf_words_out.write(words_out);
+                } else {
+                    z_stall++;
+                    perf_z_stall.write(z_stall);
+                }
+            }
 
-            // FIR computation for a single output
-            optimize1: for (int m = 0; m < 16; m++) {
-                #pragma HLS unroll
-                if (n + m - 16 + 1 >= 0) {
-                    output_data_buffer[output_offset + n] +=
-                        weight_data_buffer[m] * input_data_buffer[n + m - 16 + 1];
+            if (!out_valid && fifo_to_store.PopNB(beat)) {
+                if (beat_kind(beat) == BEAT_STATUS) {
+                    sc_uint<8> st = beat_data(beat).range(7, 0);
+                    st_out.write(st);
+                    if (st == 0x3) {
+                        jobs++;
+                        perf_jobs.write(jobs);
+                    }
+                } else if (beat_kind(beat) == BEAT_CLEAR) {
+                    z_stall = 0;
+                    words_out = 0;
+                    jobs = 0;
+                    perf_z_stall.write(0);
+                    perf_words_out.write(0);
+                    perf_jobs.write(0);
+                } else {
+                    out_data = beat_data(beat);
+                    out_valid = true;
                 }
             }
+            wait(); // Maintain timing and synchronization
+        }
+    }
 
-            packed_output = assign_packed_output(packed_output, output_data_buffer[output_offset + n], pack_index);
-            pack_index++;
+private:
+    void clear_delay_line(Sample* delay_line, int& delay_head, Acc* partial_sums) {
+        #pragma HLS inline
+        clear_history: for (int k = 0; k < HISTORY; k++) {
+            #pragma HLS unroll
+            delay_line[k] = 0;
+            partial_sums[k] = 0;
+        }
+        delay_head = 0;
+    }
 
-            if (pack_index == 4) {
-                z_out.Push(packed_output);
-                pack_index = 0;
-                packed_output = 0; // Reset packed output for the next group
+    void clear_rate_state(int& rate_phase, AXI_DATA& out_word, int& out_count) {
+        #pragma HLS inline
+        rate_phase = 0;
+        out_word = 0;
+        out_count = 0;
+    }
+
+    // Packs one rate-changed output into a channel's z_out word and
+    // pushes the word once PACK outputs have been collected
+    void emit_output(Sample value, AXI_DATA& out_word, int& out_count) {
+        #pragma HLS inline
+        out_word = assign_packed_output(out_word, value, out_count);
+        out_count++;
+        if (out_count == PACK) {
+            compute_to_fifo.Push(make_beat(BEAT_DATA, out_word));
+            out_word = 0;
+            out_count = 0;
+        }
+    }
+
+    // Signed sample `index` of a packed word
+    Sample unpack_sample(AXI_DATA data, int index) {
+        #pragma HLS inline
+        return Sample(data.range(index * SAMPLE_BITS + SAMPLE_BITS - 1, index * SAMPLE_BITS).to_uint64());
+    }
+
+    // Converts the accumulator to an output sample: the low OUT_SHIFT
+    // bits are treated as fraction, then rounding and overflow follow
+    // OUT_MODE.
+    Sample quantize(Acc acc) {
+        #pragma HLS inline
+        ac_fixed<ACC_BITS, ACC_BITS - OUT_SHIFT, true> scaled;
+        scaled.set_slc(0, acc);
+        ac_fixed<SAMPLE_BITS, SAMPLE_BITS, true, OUT_Q, OUT_O> out = scaled;
+        return out.template slc<SAMPLE_BITS>(0);
+    }
+
+    // FIR computation for a single output.  window[0] is the oldest of the
+    // TAPS samples and pairs with weight_data_buffer[0].
+    // With FOLD the weights are assumed symmetric (w[m] == w[TAPS-1-m]),
+    // so mirrored samples are pre-added and only the first half of the
+    // weights is multiplied.  Only weights 0..(TAPS-1)/2 are read.
+    Sample fir_output(Sample* window, Sample* weight_data_buffer) {
+        #pragma HLS inline
+        Acc acc = 0;
+        if (FOLD) {
+            fold: for (int m = 0; m < TAPS / 2; m++) {
+                #pragma HLS unroll
+                ac_int<SAMPLE_BITS + 1, true> folded = window[m] + window[TAPS - 1 - m];
+                acc += weight_data_buffer[m] * folded;
+            }
+            if (TAPS % 2) { // Centre tap of an odd-length filter has no mirror
+                acc += weight_data_buffer[TAPS / 2] * window[TAPS / 2];
+            }
+        } else {
+            optimize1: for (int m = 0; m < TAPS; m++) {
+                #pragma HLS unroll
+                acc += weight_data_buffer[m] * window[m];
+            }
+        }
+        return quantize(acc);
+    }
+
+    // Interpolation output for phase p (0 <= p < rate) of the newest
+    // sample window[TAPS-1].  With rate-1 zeros implied after every input
+    // sample, only the weights w[TAPS-1-p-k*rate] meet a real sample, so
+    // the branch has ceil((TAPS-p)/rate) taps.  PHASE_TAPS multipliers
+    // cover the longest branch of any rate from 2 up.
+    Sample fir_phase(Sample* window, Sample* weight_data_buffer, int p, int rate) {
+        #pragma HLS inline
+        Acc acc = 0;
+        polyphase: for (int k = 0; k < PHASE_TAPS; k++) {
+            #pragma HLS unroll
+            int tap = p + k * rate; // Distance from the newest weight
+            if (tap < TAPS) {
+                acc += weight_data_buffer[TAPS - 1 - tap] * window[TAPS - 1 - k];
             }
         }
+        return quantize(acc);
+    }
 
-        if (pack_index > 0) {
-            z_out.Push(packed_output);
+    // One transposed-form step for input sample x.  The output is the
+    // oldest partial sum plus the newest weight's product; every other
+    // partial sum takes one product and shifts one place towards the
+    // output, so no path is longer than one multiply-add.
+    Sample transposed_step(Sample x, Acc* partial_sums, Sample* weight_data_buffer) {
+        #pragma HLS inline
+        Acc y = partial_sums[0] + weight_data_buffer[TAPS - 1] * x;
+        transposed_taps: for (int i = 0; i < HISTORY - 1; i++) {
+            #pragma HLS unroll
+            partial_sums[i] = partial_sums[i + 1] + weight_data_buffer[TAPS - 2 - i] * x;
+        }
+        partial_sums[HISTORY - 1] = weight_data_buffer[0] * x;
+        return quantize(y);
+    }
+
+    // Transposed-form step for a zero input sample: the chain only shifts
+    Sample transposed_shift(Acc* partial_sums) {
+        #pragma HLS inline
+        Acc y = partial_sums[0];
+        transposed_shift_taps: for (int i = 0; i < HISTORY - 1; i++) {
+            #pragma HLS unroll
+            partial_sums[i] = partial_sums[i + 1];
+        }
+        partial_sums[HISTORY - 1] = 0;
+        return quantize(y);
+    }
+
+    // Builds the window of HISTORY+PACK samples for one word from the
+    // circular delay line and the PACK new samples.
+    void load_window(AXI_DATA data, Sample* delay_line, int delay_head, Sample* window) {
+        #pragma HLS inline
+        window_history: for (int k = 0; k < HISTORY; k++) {
+            #pragma HLS unroll
+            int slot = delay_head + k;
+            if (slot >= HISTORY) {
+                slot -= HISTORY;
+            }
+            window[k] = delay_line[slot];
+        }
+
+        window_unpack: for (int k = 0; k < PACK; k++) {
+            #pragma HLS unroll
+            window[HISTORY + k] = unpack_sample(data, k);
+        }
+    }
+
+    // Filters the PACK samples of a window against TAPS weights and
+    // returns the results packed into one z_out word.  LANES outputs
+    // are produced per optimize2 iteration.
+    AXI_DATA filter_word(Sample* window, Sample* weight_data_buffer) {
+        #pragma HLS inline
+        AXI_DATA packed_output = 0;
+
+        optimize2: for (int n = 0; n < PACK; n += LANES) {
+            #pragma HLS pipeline II=1
+            lanes: for (int l = 0; l < LANES; l++) {
+                #pragma HLS unroll
+                packed_output = assign_packed_output(packed_output, fir_output(&window[n + l], weight_data_buffer), n + l);
+            }
+        }
+        return packed_output;
+    }
+
+    // History carries over between words, so no control write is needed
+    // between streaming blocks.  The PACK oldest samples are replaced by
+    // the PACK newest ones; a word of at least HISTORY samples (wide
+    // beats, few taps) replaces the whole history.
+    void advance_delay_line(Sample* delay_line, int& delay_head, Sample* window) {
+        #pragma HLS inline
+        if (PACK >= HISTORY) {
+            window_refill: for (int k = 0; k < HISTORY; k++) {
+                #pragma HLS unroll
+                delay_line[k] = window[PACK + k];
+            }
+            delay_head = 0;
+        } else {
+            window_update: for (int k = 0; k < DELAY_UPDATE; k++) {
+                #pragma HLS unroll
+                int slot = delay_head + k;
+                if (slot >= HISTORY) {
+                    slot -= HISTORY;
+                }
+                delay_line[slot] = window[HISTORY + k];
+            }
+            delay_head += PACK;
+            if (delay_head >= HISTORY) {
+                delay_head -= HISTORY;
+            }
         }
     }
 };
 
+// Top-level instantiation used by TlmToConn and by Catapult (TOP_NAME).
+class Accelerator : public AcceleratorT<FIR_TAPS, FIR_SAMPLE_BITS, FIR_BLOCK, FIR_SEG1, FIR_LANES, FIR_FOLD,
+                                        FIR_ACC_BITS, FIR_OUT_MODE, FIR_OUT_SHIFT, FIR_CHANNELS, FIR_MAX_RATE, FIR_ARCH,
+                                        FIR_BEAT_BITS> {
+public:
+    Accelerator(sc_module_name name_)
+        : AcceleratorT<FIR_TAPS, FIR_SAMPLE_BITS, FIR_BLOCK, FIR_SEG1, FIR_LANES, FIR_FOLD,
+                       FIR_ACC_BITS, FIR_OUT_MODE, FIR_OUT_SHIFT, FIR_CHANNELS, FIR_MAX_RATE, FIR_ARCH,
+                       FIR_BEAT_BITS>(name_) {}
+};
@@ -0,0 +1,353 @@
+/*****************************************************************************
+
+  The following code is derived, directly or indirectly, from the SystemC
+  source code Copyright (c) 1996-2008 by all Contributors.
+  All Rights reserved.
+
+  The contents of this file are subject to the restrictions and limitations
+  set forth in the SystemC Open Source License Version 3.0 (the "License");
+  You may not use this file except in compliance with such restrictions and
+  limitations. You may obtain instructions on how to receive a copy of the
+  License at http://www.systemc.org/. Software distributed by Contributors
+  under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF
+  ANY KIND, either express or implied. See the License for the specific
+  language governing rights and limitations under the License.
+
+ *****************************************************************************/
+
+#ifndef __SIMPLEBUSAT_H__
+#define __SIMPLEBUSAT_H__
+
+//#include <systemc>
+#include "tlm.h"
+
+#include "tlm_utils/simple_target_socket.h"
+#include "tlm_utils/simple_initiator_socket.h"
+#include "tlm_utils/peq_with_get.h"
+
+#include "stats.h"
+#include <map>
+#include <string>
+
+//
+// Approximately-timed variant of SimpleBusLT/SimpleBusLT16.
+//
+// Initiators use the base protocol (nb_transport_fw/bw); blocking
+// initiators such as the CPU and the DMA are converted by the target
+// sockets, so a thread blocked in b_transport is one outstanding
+// transaction.  Each target has a request queue served by depth slots.
+// END_REQ is sent when a slot takes the request, so an initiator can
+// issue its next request while earlier ones are still in the target.
+// The targets in this platform are LT, so every slot forwards its
+// request with b_transport and then returns BEGIN_RESP; responses to
+// one initiator are returned one at a time.
+//
+// A slot is held across the target's b_transport, so it is only safe
+// for targets that always complete on their own (memory).  A target
+// whose call can wait for another transaction -- a register write that
+// runs a synchronous DMA job, intc's wait register, an Accelerator z
+// read, or a bridge to another bus carrying any of these -- must be
+// marked with passThrough(); its requests are still accepted by a slot
+// but each call runs in its own process, so a blocked call never keeps
+// a later transaction from reaching the target.
+//
+// Transactions are counted at the initiator and at the target as in
+// the LT buses.  The latency runs from BEGIN_REQ to the end of the
+// response, and the stall is the time a request waited in its queue
+// for a free slot.
+//
+// The address decoder is the same as SimpleBusLT's with the port number
+// in the address bits above PORT_SHIFT (28 for bus0, 16 for bus1).
+//
+template <int NR_OF_INITIATORS, int NR_OF_TARGETS, int PORT_SHIFT=28>
+class SimpleBusAT : public sc_core::sc_module
+{
+public:
+  typedef tlm::tlm_generic_payload                 transaction_type;
+  typedef tlm::tlm_phase                           phase_type;
+  typedef tlm::tlm_sync_enum                       sync_enum_type;
+  typedef tlm_utils::simple_target_socket_tagged<SimpleBusAT,64>    target_socket_type;
+  typedef tlm_utils::simple_initiator_socket_tagged<SimpleBusAT,64> initiator_socket_type;
+
+public:
+  target_socket_type target_socket[NR_OF_INITIATORS];
+  initiator_socket_type initiator_socket[NR_OF_TARGETS];
+
+public:
+  SC_HAS_PROCESS(SimpleBusAT);
+  SimpleBusAT(sc_core::sc_module_name name, unsigned int depth=2) :
+    sc_core::sc_module(name)
+  {
+    assert(depth > 0);
+    for (unsigned int i = 0; i < NR_OF_INITIATORS; ++i) {
+      // No b_transport: blocking calls are converted to nb_transport_fw
+      // by the socket, so they go through the request queues too
+      target_socket[i].register_nb_transport_fw(this, &SimpleBusAT::initiatorNBTransport, i);
+      target_socket[i].register_transport_dbg(this, &SimpleBusAT::transportDebug, i);
+      target_socket[i].register_get_direct_mem_ptr(this, &SimpleBusAT::getDMIPointer, i);
+    }
+    for (unsigned int i = 0; i < NR_OF_TARGETS; ++i) {
+      initiator_socket[i].register_invalidate_direct_mem_ptr(this, &SimpleBusAT::invalidateDMIPointers, i);
+      mRequestPEQ[i] = new tlm_utils::peq_with_get<transaction_type>(sc_core::sc_gen_unique_name("requestPEQ"));
+      mPassThrough[i] = false;
+      for (unsigned int j = 0; j < depth; ++j)
+        sc_core::sc_spawn(sc_bind(&SimpleBusAT::targetSlot, this, i),
+                          sc_core::sc_gen_unique_name("targetSlot"));
+    }
+    for (unsigned int i = 0; i < NR_OF_INITIATORS; ++i)
+      mInitiatorStats[i] = new stats::counter(std::string(name()) + ".init" + std::to_string(i));
+    for (unsigned int i = 0; i < NR_OF_TARGETS; ++i)
+      mTargetStats[i] = new stats::counter(std::string(name()) + ".target" + std::to_string(i));
+  }
+
+  // Requests to portId no longer occupy a slot while the target runs
+  void passThrough(unsigned int portId)
+  {
+    assert(portId < NR_OF_TARGETS);
+    mPassThrough[portId] = true;
+  }
+
+  ~SimpleBusAT()
+  {
+    for (unsigned int i = 0; i < NR_OF_TARGETS; ++i)
+      delete mRequestPEQ[i];
+    for (unsigned int i = 0; i < NR_OF_INITIATORS; ++i)
+      delete mInitiatorStats[i];
+    for (unsigned int i = 0; i < NR_OF_TARGETS; ++i)
+      delete mTargetStats[i];
+  }
+
+  //
+  // Dummy decoder:
+  // - address[63-PORT_SHIFT]: portId
+  // - address[PORT_SHIFT-1-0]: masked address
+  //
+
+  unsigned int getPortId(const sc_dt::uint64& address)
+  {
+    return (unsigned int)address >> PORT_SHIFT;
+  }
+
+  sc_dt::uint64 getAddressOffset(unsigned int portId)
+  {
+    return (sc_dt::uint64)portId << PORT_SHIFT;
+  }
+
+  sc_dt::uint64 getAddressMask(unsigned int portId)
+  {
+    return ((sc_dt::uint64)1 << PORT_SHIFT) - 1;
+  }
+
+  unsigned int decode(const sc_dt::uint64& address)
+  {
+    // decode address:
+    // - return initiator socket id
+
+    return getPortId(address);
+  }
+
+  //
+  // interface methods
+  //
+
+  //
+  // AT protocol
+  // - BEGIN_REQ is queued for the target, END_REQ follows when a slot
+  //   takes it
+  // - END_RESP releases the response path to the initiator
+  //
+  sync_enum_type initiatorNBTransport(int initiatorId,
+                                      transaction_type& trans,
+                                      phase_type& phase,
+                                      sc_core::sc_time& t)
+  {
+    if (phase == tlm::BEGIN_REQ) {
+      unsigned int portId = decode(trans.get_address());
+      assert(portId < NR_OF_TARGETS);
+      if (trans.has_mm())
+        trans.acquire();
+      mInitiator[&trans] = initiatorId;
+      mBegin[&trans] = sc_core::sc_time_stamp() + t;
+      mRequestPEQ[portId]->notify(trans, t);
+      return tlm::TLM_ACCEPTED;
+
+    } else if (phase == tlm::END_RESP) {
+      mEndResponse[initiatorId].notify(t);
+      return tlm::TLM_COMPLETED;
+
+    } else {
+      std::cout << "ERROR: '" << name()
+                << "': Illegal phase received from initiator." << std::endl;
+      assert(false); exit(1);
+    }
+  }
+
+  //
+  // One outstanding transaction slot of a target
+  //
+  void targetSlot(unsigned int portId)
+  {
+    transaction_type* trans;
+    phase_type phase;
+    sc_core::sc_time t;
+
+    while (true) {
+      while (!(trans = mRequestPEQ[portId]->get_next_transaction()))
+        sc_core::wait(mRequestPEQ[portId]->get_event());
+      int initiatorId = mInitiator[trans];
+      mInitiator.erase(trans);
+      sc_core::sc_time begin = mBegin[trans];
+      mBegin.erase(trans);
+      sc_core::sc_time queued = sc_core::sc_time_stamp() - begin;
+      mInitiatorStats[initiatorId]->stall += queued;
+      mTargetStats[portId]->stall += queued;
+
+      // Request accepted
+      phase = tlm::END_REQ;
+      t = sc_core::SC_ZERO_TIME;
+      target_socket[initiatorId]->nb_transport_bw(*trans, phase, t);
+
+      if (mPassThrough[portId])
+        sc_core::sc_spawn(sc_bind(&SimpleBusAT::complete, this, portId, initiatorId, trans, begin),
+                          sc_core::sc_gen_unique_name("complete"));
+      else
+        complete(portId, initiatorId, trans, begin);
+    }
+  }
+
+  //
+  // Target call and response of an accepted request
+  //
+  void complete(unsigned int portId, int initiatorId,
+                transaction_type* trans, sc_core::sc_time begin)
+  {
+    phase_type phase;
+    sc_core::sc_time t;
+
+    t = sc_core::SC_ZERO_TIME;
+    trans->set_address(trans->get_address() & getAddressMask(portId));
+    initiator_socket[portId]->b_transport(*trans, t);
+    sc_core::wait(t);
+
+    // Base protocol: one response at a time per initiator
+    mResponseMutex[initiatorId].lock();
+    phase = tlm::BEGIN_RESP;
+    t = sc_core::SC_ZERO_TIME;
+    switch (target_socket[initiatorId]->nb_transport_bw(*trans, phase, t)) {
+    case tlm::TLM_ACCEPTED:
+      sc_core::wait(mEndResponse[initiatorId]);
+      break;
+    case tlm::TLM_UPDATED:
+      if (phase != tlm::END_RESP) {
+        std::cout << "ERROR: '" << name()
+                  << "': Illegal phase received from initiator." << std::endl;
+        assert(false); exit(1);
+      }
+      // Fall through
+    case tlm::TLM_COMPLETED:
+      sc_core::wait(t);
+      break;
+    }
+    mResponseMutex[initiatorId].unlock();
+
+    sc_core::sc_time latency = sc_core::sc_time_stamp() - begin;
+    mInitiatorStats[initiatorId]->record(trans->get_data_length(), latency);
+    mTargetStats[portId]->record(trans->get_data_length(), latency);
+
+    if (trans->has_mm())
+      trans->release();
+  }
+
+  unsigned int transportDebug(int SocketId,
+                              transaction_type& trans)
+  {
+    unsigned int portId = decode(trans.get_address());
+    assert(portId < NR_OF_TARGETS);
+    initiator_socket_type* decodeSocket = &initiator_socket[portId];
+    trans.set_address( trans.get_address() & getAddressMask(portId) );
+
+    return (*decodeSocket)->transport_dbg(trans);
+  }
+
+  bool limitRange(unsigned int portId, sc_dt::uint64& low, sc_dt::uint64& high)
+  {
+    sc_dt::uint64 addressOffset = getAddressOffset(portId);
+    sc_dt::uint64 addressMask = getAddressMask(portId);
+
+    if (low > addressMask) {
+      // Range does not overlap with addressrange for this target
+      return false;
+    }
+
+    low += addressOffset;
+    if (high > addressMask) {
+      high = addressOffset + addressMask;
+
+    } else {
+      high += addressOffset;
+    }
+    return true;
+  }
+
+  bool getDMIPointer(int SocketId,
+                     transaction_type& trans,
+                     tlm::tlm_dmi&  dmi_data)
+  {
+    sc_dt::uint64 address = trans.get_address();
+
+    unsigned int portId = decode(address);
+    assert(portId < NR_OF_TARGETS);
+    initiator_socket_type* decodeSocket = &initiator_socket[portId];
+    sc_dt::uint64 maskedAddress = address & getAddressMask(portId);
+
+    trans.set_address(maskedAddress);
+
+    bool result =
+      (*decodeSocket)->get_direct_mem_ptr(trans, dmi_data);
+
+    if (result)
+    {
+      // Range must contain address
+      assert(dmi_data.get_start_address() <= maskedAddress);
+      assert(dmi_data.get_end_address() >= maskedAddress);
+    }
+
+    // Should always succeed
+    sc_dt::uint64 start, end;
+    start = dmi_data.get_start_address();
+    end = dmi_data.get_end_address();
+
+    limitRange(portId, start, end);
+
+    dmi_data.set_start_address(start);
+    dmi_data.set_end_address(end);
+
+    return result;
+  }
+
+  void invalidateDMIPointers(int port_id,
+                             sc_dt::uint64 start_range,
+                             sc_dt::uint64 end_range)
+  {
+    if (!limitRange(port_id, start_range, end_range)) {
+      // Range does not fall into address range of target
+      return;
+    }
+
+    for (unsigned int i = 0; i < NR_OF_INITIATORS; ++i) {
+      (target_socket[i])->invalidate_direct_mem_ptr(start_range, end_range);
+    }
+  }
+
+private:
+  tlm_utils::peq_with_get<transaction_type>* mRequestPEQ[NR_OF_TARGETS];
+  std::map<transaction_type*, int> mInitiator;   // Queued request -> initiator
+  std::map<transaction_type*, sc_core::sc_time> mBegin;  // Queued request -> BEGIN_REQ time
+  sc_core::sc_event mEndResponse[NR_OF_INITIATORS];
+  sc_core::sc_mutex mResponseMutex[NR_OF_INITIATORS];
+  bool mPassThrough[NR_OF_TARGETS];
+  stats::counter* mInitiatorStats[NR_OF_INITIATORS];
+  stats::counter* mTargetStats[NR_OF_TARGETS];
+};
+
+#endif
@@ -24,6 +24,9 @@
 #include "tlm_utils/simple_target_socket.h"
 #include "tlm_utils/simple_initiator_socket.h"
 
+#include "stats.h"
+#include <string>
+
 template <int NR_OF_INITIATORS, int NR_OF_TARGETS>
 class SimpleBusLT : public sc_core::sc_module
 {
@@ -51,6 +54,20 @@ public:
     for (unsigned int i = 0; i < NR_OF_TARGETS; ++i) {
       initiator_socket[i].register_invalidate_direct_mem_ptr(this, &SimpleBusLT::invalidateDMIPointers, i);
     }
+    // Every transaction is counted at the initiator it came from and
+    // at the target it went to
+    for (unsigned int i = 0; i < NR_OF_INITIATORS; ++i)
+      mInitiatorStats[i] = new stats::counter(std::string(name()) + ".init" + std::to_string(i));
+    for (unsigned int i = 0; i < NR_OF_TARGETS; ++i)
+      mTargetStats[i] = new stats::counter(std::string(name()) + ".target" + std::to_string(i));
+  }
+
+  ~SimpleBusLT()
+  {
+    for (unsigned int i = 0; i < NR_OF_INITIATORS; ++i)
+      delete mInitiatorStats[i];
+    for (unsigned int i = 0; i < NR_OF_TARGETS; ++i)
+      delete mTargetStats[i];
   }
 
   //
@@ -100,7 +117,13 @@ public:
     decodeSocket = &initiator_socket[portId];
     trans.set_address(trans.get_address() & getAddressMask(portId));
 
+    // Latency covers both the time the target waited and the delay it
+    // annotated
+    sc_core::sc_time begin = sc_core::sc_time_stamp() + t;
     (*decodeSocket)->b_transport(trans, t);
+    sc_core::sc_time latency = sc_core::sc_time_stamp() + t - begin;
+    mInitiatorStats[SocketId]->record(trans.get_data_length(), latency);
+    mTargetStats[portId]->record(trans.get_data_length(), latency);
   }
 
   unsigned int transportDebug(int SocketId,
@@ -186,6 +209,9 @@ public:
     }
   }
 
+private:
+  stats::counter* mInitiatorStats[NR_OF_INITIATORS];
+  stats::counter* mTargetStats[NR_OF_TARGETS];
 };
 
 #endif
@@ -24,12 +24,14 @@ using namespace  std;
 
 
 SC_HAS_PROCESS(TlmToConn);
-TlmToConn::TlmToConn( sc_core::sc_module_name module_name)
+TlmToConn::TlmToConn( sc_core::sc_module_name module_name, bool verbose )
   : sc_module (module_name),
+    m_verbose (verbose),
     clk("clk", 1.0, SC_NS, 0.5, 0, SC_NS, true)
 
 {
   target.register_b_transport(this, &TlmToConn::custom_b_transport);
+  driver.verbose=verbose;
   Connections::set_sim_clk(&clk);
   dut.clk(clk);
   driver.clk(clk);
@@ -46,6 +48,13 @@ TlmToConn::TlmToConn( sc_core::sc_module_name module_name)
 
   dut.st_out(st_sig);
   driver.st_in(st_sig);
+  dut.perf_busy(perf_sig[PERF_BUSY]);
+  dut.perf_z_stall(perf_sig[PERF_Z_STALL]);
+  dut.perf_x_idle(perf_sig[PERF_X_IDLE]);
+  dut.perf_words_in(perf_sig[PERF_WORDS_IN]);
+  dut.perf_words_out(perf_sig[PERF_WORDS_OUT]);
+  dut.perf_jobs(perf_sig[PERF_JOBS]);
+  driver.perf_in(perf_sig);
 
   dut.ctrl_in(ctrl_in);
   ctrl_fifo.deq(ctrl_in);
@@ -68,6 +77,14 @@ TlmToConn::TlmToConn( sc_core::sc_module_name module_name)
   z_fifo.deq(z_in);
 
   SC_THREAD(run);
+
+  SC_METHOD(irq_update);
+  sensitive << st_sig;
+}
+
+void TlmToConn::irq_update()
+{
+    irq.write(st_sig.read() == 0x3);
 }
 
 void TlmToConn::run()
@@ -95,17 +112,18 @@ TlmToConn::custom_b_transport
   sc_core::sc_time mem_delay(10,sc_core::SC_NS);
 
   tlm::tlm_generic_payload *gpp;
+  int q=TlmToConnDriver::decode(command, address, length);
 
-  cout << sc_core::sc_time_stamp() << " " << sc_object::name();
+  if (m_verbose) cout << sc_core::sc_time_stamp() << " " << sc_object::name();
   switch (command) {
     case tlm::TLM_WRITE_COMMAND:
     {
-      cout << " WRITE len:0x" << hex << length << " addr:0x" << address << endl;
+      if (m_verbose) cout << " WRITE len:0x" << hex << length << " addr:0x" << address << endl;
       break;
     }
     case tlm::TLM_READ_COMMAND:
     {
-      cout << " READ len:0x" << hex << length << " addr:0x" << address << endl; 
+      if (m_verbose) cout << " READ len:0x" << hex << length << " addr:0x" << address << endl; 
       break;
     }
     default:
@@ -114,17 +132,38 @@ TlmToConn::custom_b_transport
     } 
   }
 
-  m_mutex.lock();
-  driver.inq.push(&gp);
-  wait(driver.outpeq.get_event());
-  gpp=driver.outpeq.get_next_transaction();
+  if (q < 0) {
+    if (command==tlm::TLM_READ_COMMAND || command==tlm::TLM_WRITE_COMMAND)
+      cout << "\nError @" << sc_core::sc_time_stamp() << " from " << name()
+          << ": " << ((command==tlm::TLM_READ_COMMAND) ? "READ" : "WRITE")
+          << " addr=0x" << hex << address << " length=0x" << length
+          << " not supported" << endl;
+    gp.set_response_status( tlm::TLM_COMMAND_ERROR_RESPONSE );
+    return;
+  }
+
+  sc_core::sc_time begin=sc_core::sc_time_stamp();
+  if (q == TlmToConnDriver::Q_CTRL)
+    driver.ctrl_issued++;
+  else if (q == TlmToConnDriver::Q_ST) {
+    // Software polling st after a ctrl write sees the effect of that
+    // write, as when ctrl and st shared one queue
+    unsigned long long fence=driver.ctrl_issued;
+    while (driver.ctrl_done < fence)
+      wait(driver.ctrl_event);
+  }
+  m_mutex[q].lock();
+  driver.inq[q].push(&gp);
+  wait(driver.outpeq[q].get_event());
+  gpp=driver.outpeq[q].get_next_transaction();
   if (gpp!=&gp) {
     cout << sc_core::sc_time_stamp() << " " << sc_object::name() 
           << " ERROR: incomming payload pointer does not match outgoing payload pointer" << endl;
   }
-  m_mutex.unlock();
+  m_mutex[q].unlock();
+  driver.stat[q]->record(length, sc_core::sc_time_stamp()-begin);
 
-  cout << sc_core::sc_time_stamp() << " " << sc_object::name() << " transaction complete" << endl;
+  if (m_verbose) cout << sc_core::sc_time_stamp() << " " << sc_object::name() << " transaction complete" << endl;
 
   if (gp.get_address()==0x08 && command==tlm::TLM_WRITE_COMMAND) {
     if (data==(unsigned long long)0x0f) {
@@ -26,6 +26,22 @@
 // VCS/SC_VERIFY simulation
 #include "sysc_sim.h"
 #endif
+
+// Depths of the FIFOs between the driver and the Accelerator.  These
+// are normally set from the Makefile (CONN_X_DEPTH=8 etc.) to size the
+// buffering against throughput; the beat width is FIR_BEAT_BITS.
+#ifndef CONN_W_DEPTH
+#define CONN_W_DEPTH 4
+#endif
+#ifndef CONN_X_DEPTH
+#define CONN_X_DEPTH 4
+#endif
+#ifndef CONN_Z_DEPTH
+#define CONN_Z_DEPTH 4
+#endif
+#ifndef CONN_CTRL_DEPTH
+#define CONN_CTRL_DEPTH 1
+#endif
  
  
 
@@ -35,23 +51,33 @@ class TlmToConn: public sc_core::sc_module
 
   static const unsigned int buswidth=64;
   sc_dt::uint64  m_memory_size;
-  sc_core::sc_mutex m_mutex;
+  // One transaction at a time per driver queue, so each outpeq only
+  // ever returns the payload of the caller waiting on it
+  sc_core::sc_mutex m_mutex[TlmToConnDriver::NUM_QUEUES];
+
+  bool m_verbose;   // Log every transaction and beat
 
-  TlmToConn( sc_core::sc_module_name module_name);
+  TlmToConn( sc_core::sc_module_name module_name, bool verbose = true );
 
   tlm_utils::simple_target_socket<TlmToConn,buswidth>  target;
 
   TlmToConnDriver driver{"driver"};
 
   sc_signal<sc_uint<8>> st_sig{"st_sig"};
+  sc_vector< sc_signal<sc_uint<32>> > perf_sig{"perf_sig", PERF_COUNTERS};
 
-  Connections::Combinational<sc_uint<64>> w_in{"w_in"},w_out{"w_out"},
+  typedef TlmToConnDriver::Data Data;
+  Connections::Combinational<Data> w_in{"w_in"},w_out{"w_out"},
     x_in{"x_in"},x_out{"x_out"},z_in{"z_in"},z_out{"z_out"};
   Connections::Combinational<sc_uint<8>> ctrl_in{"ctrl_in"},ctrl_out{"ctrl_out"};
-  Connections::Fifo<sc_uint<64>,4> w_fifo{"w_fifo"}, x_fifo{"x_fifo"}, z_fifo{"z_fifo"};
-  Connections::Fifo<sc_uint<8>,1> ctrl_fifo{"ctrl_fifo"};
+  Connections::Fifo<Data,CONN_W_DEPTH> w_fifo{"w_fifo"};
+  Connections::Fifo<Data,CONN_X_DEPTH> x_fifo{"x_fifo"};
+  Connections::Fifo<Data,CONN_Z_DEPTH> z_fifo{"z_fifo"};
+  Connections::Fifo<sc_uint<8>,CONN_CTRL_DEPTH> ctrl_fifo{"ctrl_fifo"};
  
 
+  // The instantiation (taps, sample width, block size) is selected
+  // with the FIR_* compiler flags, see Accelerator.h
 #ifndef TOP_HDL_ENTITY
   CCS_DESIGN(Accelerator) dut{"dut"};
 #else
@@ -61,9 +87,13 @@ class TlmToConn: public sc_core::sc_module
   sc_clock clk;
   sc_signal<bool> reset_bar{"reset_bar"};
 
+  // Raised while the Accelerator reports a finished segment (st 0x3)
+  sc_out<bool> irq{"irq"};
+
   private:
 
   void run();	    
+  void irq_update();
 
   void custom_b_transport
   ( tlm::tlm_generic_payload &gp, sc_core::sc_time &delay );
@@ -19,11 +19,14 @@
 // #include <axi/axi4.h>
 #include <nvhls_connections.h>
 #include <hls_globals.h>
+#include "Accelerator.h"
+#include "stats.h"
 
 #include <queue>
 #include <string>
 #include <iomanip>
 #include <sstream>
+#include <cstring>
 // #include <vector>
 // #include <map>
 // #include <math.h>
@@ -39,14 +42,47 @@ class TlmToConnDriver : public sc_module {
   sc_in<bool> reset_bar;
   sc_in<bool> clk;
 
-  std::queue <tlm::tlm_generic_payload*> inq;
-  tlm_utils::peq_with_get<tlm::tlm_generic_payload> outpeq;
+  // One queue per Accelerator channel, each served by its own thread,
+  // so a read stalled on an empty z FIFO does not hold up w/x writes,
+  // ctrl writes or st reads.  st reads still follow earlier ctrl
+  // writes (see ctrl_issued).  A completed transaction is returned on
+  // the outpeq of its queue.
+  enum queue_id { Q_CTRL, Q_W, Q_X, Q_Z, Q_ST, NUM_QUEUES };
+  std::queue <tlm::tlm_generic_payload*> inq[NUM_QUEUES];
+  sc_vector< tlm_utils::peq_with_get<tlm::tlm_generic_payload> > outpeq;
 
-  static const int DATA_WIDTH = 64;
+  // ctrl writes received by TlmToConn and completed by run_ctrl.  An
+  // st read waits until the ctrl writes received before it are done,
+  // so status and counters are never read ahead of an earlier command.
+  unsigned long long ctrl_issued, ctrl_done;
+  sc_event ctrl_event;
+
+  // Beats follow the Accelerator's w/x/z word width (FIR_BEAT_BITS).
+  // Each beat is bytesPerBeat bytes of the payload, lowest address in
+  // the least-significant bits.  A short last w/x beat is zero padded;
+  // z reads may end inside a beat (see run_z).
+  static const int DATA_WIDTH = FIR_BEAT_BITS;
   static const int bytesPerBeat = DATA_WIDTH >> 3;
-  typedef sc_uint<DATA_WIDTH> Data;
+  static const int wordsPerBeat = DATA_WIDTH >> 6;
+  typedef Accelerator::AXI_DATA Data;
+
+  // Per-beat logging; when false the data path does no formatting
+  bool verbose;
+
+  // Transactions of each queue.  TlmToConn records their latency; the
+  // driver adds as stall the time a beat waited on a full w/x/ctrl
+  // FIFO or an empty z FIFO (including the cycle that moved it).
+  stats::counter *stat[NUM_QUEUES];
 
   sc_in<sc_uint<8>> st_in;
+  // Segment commands (ctrl 0x2 or 0x9) accepted by run_ctrl whose start
+  // the Accelerator has not reported yet.  st reads return 0x2 (segment
+  // running) while any are outstanding, so a poll right after the ctrl
+  // write cannot see the previous segment's 0x3.
+  unsigned int seg_pending;
+  // Accelerator performance counters, read at PERF_BASE + 8 * n
+  static const int PERF_BASE = 0x20;
+  sc_vector< sc_in<sc_uint<32>> > perf_in;
   Connections::Out<sc_uint<8>> ctrl_out;
   Connections::Out<Data> w_out;
   Connections::Out<Data> x_out;
@@ -55,128 +91,307 @@ class TlmToConnDriver : public sc_module {
 
   SC_CTOR(TlmToConnDriver)
       : reset_bar("reset_bar"), clk("clk"), 
-        outpeq("outpeq"), st_in("st_in"), ctrl_out("ctrl_out"),
+        outpeq("outpeq", NUM_QUEUES), ctrl_issued(0), ctrl_done(0), verbose(true), st_in("st_in"), seg_pending(0),
+        perf_in("perf_in", PERF_COUNTERS), ctrl_out("ctrl_out"),
         w_out("w_out"), x_out("x_out"), z_in("z_in") {
 
-    SC_THREAD(run);
+    SC_THREAD(run_ctrl);
+    sensitive << clk.pos();
+    async_reset_signal_is(reset_bar, false);
+    SC_THREAD(run_w);
     sensitive << clk.pos();
     async_reset_signal_is(reset_bar, false);
+    SC_THREAD(run_x);
+    sensitive << clk.pos();
+    async_reset_signal_is(reset_bar, false);
+    SC_THREAD(run_z);
+    sensitive << clk.pos();
+    async_reset_signal_is(reset_bar, false);
+    SC_THREAD(run_st);
+    sensitive << clk.pos();
+    async_reset_signal_is(reset_bar, false);
+    SC_METHOD(st_watch);
+    sensitive << st_in;
+    dont_initialize();
+
+    for (int q=0 ; q<NUM_QUEUES ; q++)
+      stat[q]=new stats::counter(std::string(name())+"."+queue_name(q));
+  }
+
+  ~TlmToConnDriver() {
+    for (int q=0 ; q<NUM_QUEUES ; q++)
+      delete stat[q];
+  }
+
+  static const char *queue_name(int q) {
+    static const char *names[NUM_QUEUES]={"ctrl", "w", "x", "z", "st"};
+    return names[q];
+  }
+
+  // Queue serving a transaction, or -1 if the address and command are
+  // not supported (register offsets are addr & 0x7F)
+  static int decode(tlm::tlm_command command, sc_dt::uint64 addr,
+                    unsigned long gplen) {
+    unsigned long num_beats=(gplen % bytesPerBeat)?(gplen/bytesPerBeat+1):(gplen/bytesPerBeat);
+
+    if (command==tlm::TLM_WRITE_COMMAND) {
+      if ( ( (addr & 0x07F) == 0x08 ) && ( num_beats == 1 ) )
+        return Q_CTRL;
+      if ( ( (addr & 0x07F) == 0x18 ) && ( num_beats == 1 ) )
+        return Q_CTRL;
+      if ( (addr & 0x07F) == 0x10 )
+        return Q_W;
+      if ( (addr & 0x07F) == 0x30 )
+        return Q_X;
+    } else if (command==tlm::TLM_READ_COMMAND) {
+      if ( ( (addr & 0x07F) == 0x00 ) && ( num_beats == 1 ) )
+        return Q_ST;
+      if ( ( perf_index(addr) >= 0 ) && ( num_beats == 1 ) )
+        return Q_ST;
+      if ( (addr & 0x07F) == 0x50 )
+        return Q_Z;
+    }
+    return -1;
+  }
+
+  // Performance counter at addr, or -1
+  static int perf_index(sc_dt::uint64 addr) {
+    int off=(int)(addr & 0x07F)-PERF_BASE;
+
+    if ( (off < 0) || (off & 0x7) || (off >= 8*PERF_COUNTERS) )
+      return -1;
+    return off >> 3;
   }
 
-  
  protected:
-  void run() {
-
-    tlm::tlm_generic_payload *gpp=NULL;
-    unsigned char *dp=NULL;
-    unsigned long  gplen=0, num_beats=0;
-    unsigned int i;
-    sc_dt::uint64  addr=0;
-    unsigned long long *lldata;
+  // Next transaction of queue q.  The clock is only waited for when the
+  // queue is idle, so a queued transaction starts in the cycle the
+  // previous one ended.
+  tlm::tlm_generic_payload* next(int q) {
+    tlm::tlm_generic_payload *gpp;
+
+    while (inq[q].empty())
+      wait();
+    gpp=inq[q].front();
+    inq[q].pop();
+    return gpp;
+  }
+
+  void done(int q, tlm::tlm_generic_payload *gpp) {
+    gpp->set_response_status( tlm::TLM_OK_RESPONSE );
+    outpeq[q].notify(*gpp,SC_ZERO_TIME);
+  }
+
+  static unsigned long beats(tlm::tlm_generic_payload *gpp) {
+    unsigned long gplen=gpp->get_data_length();
+    return (gplen % bytesPerBeat)?(gplen/bytesPerBeat+1):(gplen/bytesPerBeat);
+  }
+
+  void run_ctrl() {
+    tlm::tlm_generic_payload *gpp;
     unsigned char *cdata;
+    sc_dt::uint64  addr;
+    sc_time begin;
+    bool full;
 
     ctrl_out.Reset();
+    wait();
+
+    while (1) {
+      gpp=next(Q_CTRL);
+      addr=gpp->get_address();
+      cdata=gpp->get_data_ptr();
+      full=ctrl_out.Full();
+      if ( (addr & 0x07F) == 0x08 ) {
+        if (verbose) {
+          cout << sc_time_stamp() << " " << name()
+            << " WRITE addr=0x" << hex << addr << " length=0x" << gpp->get_data_length()
+            << " data=0x" << (int)(*cdata) << endl;
+	  if (full)
+	    cout << sc_time_stamp() << " " << name() << " stalling due to push to full ctrl FIFO" << endl;
+        }
+        if ( (*cdata == CTRL_SEG1) || (*cdata == CTRL_SEG2) )
+          seg_pending++;
+        begin=sc_time_stamp();
+        ctrl_out.Push(*cdata);
+      } else {
+        // Weight bank swap: the written data is ignored, the Accelerator
+        // activates the bank loaded since the last swap at the next
+        // block (or streaming word) boundary.
+        if (verbose) {
+          cout << sc_time_stamp() << " " << name()
+            << " WRITE addr=0x" << hex << addr << " length=0x" << gpp->get_data_length()
+            << " bank swap" << endl;
+	  if (full)
+	    cout << sc_time_stamp() << " " << name() << " stalling due to push to full ctrl FIFO" << endl;
+        }
+        begin=sc_time_stamp();
+        ctrl_out.Push(0x6);
+      }
+      if (full)
+        stat[Q_CTRL]->stall+=sc_time_stamp()-begin;
+      done(Q_CTRL, gpp);
+      ctrl_done++;
+      ctrl_event.notify();
+    }
+  }
+
+  void run_w() {
+    tlm::tlm_generic_payload *gpp;
+
     w_out.Reset();
+    wait();
+
+    while (1) {
+      gpp=next(Q_W);
+      push_burst(w_out, Q_W, gpp);
+      done(Q_W, gpp);
+    }
+  }
+
+  void run_x() {
+    tlm::tlm_generic_payload *gpp;
+
     x_out.Reset();
-    z_in.Reset();
+    wait();
 
+    while (1) {
+      gpp=next(Q_X);
+      push_burst(x_out, Q_X, gpp);
+      done(Q_X, gpp);
+    }
+  }
+
+  // Burst read: one beat per cycle as the z FIFO delivers them.  A
+  // read that ends inside a beat keeps the rest of the beat for the next
+  // z read, so no samples are lost when the CPU loads 8 bytes of a wide
+  // beat at a time.
+  void run_z() {
+    tlm::tlm_generic_payload *gpp;
+    unsigned long long words[wordsPerBeat];
+    unsigned long pos, len, n;
+    unsigned long held=0;  // Unread bytes at the end of words
+    unsigned char *dp;
+    int j;
+    sc_time begin;
+    bool empty;
+
+    z_in.Reset();
     wait();
 
     while (1) {
-      wait();
-      if (!inq.empty()) {
-        gpp=inq.front();
-        inq.pop();
-        dp = gpp->get_data_ptr();
-        addr=gpp->get_address();
-        gplen=gpp->get_data_length();
-        num_beats=(gplen % bytesPerBeat)?(gplen/bytesPerBeat+1):(gplen/bytesPerBeat);
-        lldata=reinterpret_cast<unsigned long long*>(dp);
-        cdata=reinterpret_cast<unsigned char*>(dp);
-        if (gpp->get_command()==tlm::TLM_WRITE_COMMAND) {
-          if ( ( (addr & 0x07F) == 0x08 ) && ( num_beats == 1 ) ) {
-            cout << sc_time_stamp() << " " << name()
-              << " WRITE addr=0x" << hex << addr << " length=0x" << gplen
-              << " data=0x" << (int)(*cdata) << endl;
-	    if (ctrl_out.Full())
-	      cout << sc_time_stamp() << " " << name() << " stalling due to push to full ctrl FIFO" << endl;
-            ctrl_out.Push(*cdata);
-            gpp->set_response_status( tlm::TLM_OK_RESPONSE );
-            outpeq.notify(*gpp,SC_ZERO_TIME);
-          } else if ( ( (addr & 0x07F) == 0x10 ) ) {
-            for (i=0 ; i<num_beats ; i++) {
-              cout << sc_time_stamp() << " " << name()
-                << " WRITE addr=0x" << hex << addr << " length=0x" << gplen
-                << " data=0x" << lldata[i] << endl;
-	      if (w_out.Full())
-		cout << sc_time_stamp() << " " << name() << " stalling due to push to full w FIFO" << endl;
-              w_out.Push(lldata[i]);
-	      wait();
-            }
-            gpp->set_response_status( tlm::TLM_OK_RESPONSE );
-            outpeq.notify(*gpp,SC_ZERO_TIME);             
-          } else if ( ( (addr & 0x07F) == 0x30 ) ) {
-            for (i=0 ; i<num_beats ; i++) {
-              cout << sc_time_stamp() << " " << name()
-                << " WRITE addr=0x" << hex << addr << " length=0x" << gplen
-                << " data=0x" << lldata[i] << endl;
-	      if (x_out.Full())
-		cout << sc_time_stamp() << " " << name() << " stalling due to push to full x FIFO" << endl;
-              x_out.Push(lldata[i]);
-	      wait();
-            }
-            gpp->set_response_status( tlm::TLM_OK_RESPONSE );
-            outpeq.notify(*gpp,SC_ZERO_TIME);             
-          }
-          else {
-            cout << "\nError @" << sc_time_stamp() << " from " << name()
-                << ": WRITE addr=0x" << hex << addr << " length=0x" << gplen
-                << " not supported" << endl;
-            gpp->set_response_status( tlm::TLM_COMMAND_ERROR_RESPONSE );
-            outpeq.notify(*gpp,SC_ZERO_TIME);            
-          }
-        } else if (gpp->get_command()==tlm::TLM_READ_COMMAND) {
-          if ( ( (addr & 0x07F) == 0x00 ) && ( num_beats == 1 ) ) {
-            *lldata=0;  // Clear 64-bit data register
-            *cdata=st_in.read();  // Assign the least-significant 8 bits
-            cout << sc_time_stamp() << " " << name()
-              << " READ addr=0x" << hex << addr << " length=0x" << gplen
-              << " data=0x" << (int)(*cdata) << endl;
-            gpp->set_response_status( tlm::TLM_OK_RESPONSE );
-            outpeq.notify(*gpp,SC_ZERO_TIME);             
-          } else if ( ( (addr & 0x07F) == 0x50 ) ) {
-            for (i=0 ; i<num_beats ; i++) {
-	      if (z_in.Empty())
-	        cout << sc_time_stamp() << " " << name() << " stalling due to pop from empty z FIFO" << endl;
-              lldata[i]=z_in.Pop();
-              cout << sc_time_stamp() << " " << name()
-                << " READ addr=0x" << hex << addr << " length=0x" << gplen
-                << " data=0x" << lldata[i] << endl;
-	      wait();
-            }
-            gpp->set_response_status( tlm::TLM_OK_RESPONSE );
-            outpeq.notify(*gpp,SC_ZERO_TIME);             
-          } else {
-            cout << "\nError @" << sc_time_stamp() << " from " << name()
-                << ": READ addr=0x" << hex << addr << " length=0x" << gplen
-                << " not supported" << endl;
-            gpp->set_response_status( tlm::TLM_COMMAND_ERROR_RESPONSE );
-            outpeq.notify(*gpp,SC_ZERO_TIME);            
-          }
-        } else {
-          cout << "\nError @" << sc_time_stamp() << " from " << name()
-              << ": Command " << gpp->get_command() 
-              << ", addr=0x" << hex << addr << " not recognized" << endl;
-          gpp->set_response_status( tlm::TLM_COMMAND_ERROR_RESPONSE );
-          outpeq.notify(*gpp,SC_ZERO_TIME);
+      gpp=next(Q_Z);
+      dp=gpp->get_data_ptr();
+      len=gpp->get_data_length();
+      for (pos=0 ; pos<len ; pos+=n) {
+        if (held == 0) {
+          empty=z_in.Empty();
+	  if (verbose && empty)
+	    cout << sc_time_stamp() << " " << name() << " stalling due to pop from empty z FIFO" << endl;
+          begin=sc_time_stamp();
+          Data d=z_in.Pop();
+          if (empty)
+            stat[Q_Z]->stall+=sc_time_stamp()-begin;
+          for (j=0 ; j<wordsPerBeat ; j++)
+            words[j]=d.range(64*j+63, 64*j).to_uint64();
+          held=bytesPerBeat;
+          if (verbose)
+            log_beat("READ", gpp, words);
         }
+        n=(held < len-pos) ? held : len-pos;
+        memcpy(dp+pos, reinterpret_cast<unsigned char*>(words)+bytesPerBeat-held, n);
+        held-=n;
       }
+      done(Q_Z, gpp);
+    }
+  }
+
+  // Status and performance counter reads
+  void run_st() {
+    tlm::tlm_generic_payload *gpp;
+    unsigned char *cdata;
+    unsigned long long value;
+    unsigned long len;
+    int n;
 
+    wait();
+
+    while (1) {
+      gpp=next(Q_ST);
+      cdata=gpp->get_data_ptr();
+      n=perf_index(gpp->get_address());
+      if (n >= 0)
+        value=perf_in[n].read();
+      else if (seg_pending)
+        value=0x2;  // Segment running
+      else
+        value=st_in.read();
+      len=gpp->get_data_length();
+      memset(cdata, 0, len);
+      memcpy(cdata, &value, (len < sizeof(value)) ? len : sizeof(value));
+      if (verbose)
+        cout << sc_time_stamp() << " " << name()
+          << " READ addr=0x" << hex << gpp->get_address() << " length=0x" << gpp->get_data_length()
+          << " data=0x" << value << endl;
+      done(Q_ST, gpp);
     }
+  }
 
+  // Every segment starts with st 0x2, so each change to 0x2 is the
+  // start of the oldest pending segment command
+  void st_watch() {
+    if ( (st_in.read() == 0x2) && seg_pending )
+      seg_pending--;
   }
 
+  // Burst write: consecutive beats are pushed back to back, so they go
+  // out one per cycle unless the FIFO is full
+  void push_burst(Connections::Out<Data> &out, int q,
+                  tlm::tlm_generic_payload *gpp) {
+    unsigned long long words[wordsPerBeat];
+    unsigned long num_beats=beats(gpp);
+    sc_time begin;
+    bool full;
 
+    for (unsigned long i=0 ; i<num_beats ; i++) {
+      copy_beat(gpp, i, words);
+      Data d=0;
+      for (int j=0 ; j<wordsPerBeat ; j++)
+        d.range(64*j+63, 64*j)=words[j];
+      full=out.Full();
+      if (verbose) {
+        log_beat("WRITE", gpp, words);
+	if (full)
+	  cout << sc_time_stamp() << " " << name() << " stalling due to push to full " << queue_name(q) << " FIFO" << endl;
+      }
+      begin=sc_time_stamp();
+      out.Push(d);
+      if (full)
+        stat[q]->stall+=sc_time_stamp()-begin;
+    }
+  }
 
-};
+  // Copies beat i of the payload into words; a short last beat is
+  // zero padded
+  static void copy_beat(tlm::tlm_generic_payload *gpp, unsigned long i,
+                        unsigned long long *words) {
+    unsigned char *dp=gpp->get_data_ptr()+i*bytesPerBeat;
+    unsigned long len=gpp->get_data_length()-i*bytesPerBeat;
 
+    if (len > (unsigned long)bytesPerBeat)
+      len=bytesPerBeat;
+    memset(words, 0, bytesPerBeat);
+    memcpy(words, dp, len);
+  }
+
+  void log_beat(const char *dir, tlm::tlm_generic_payload *gpp,
+                const unsigned long long *words) {
+    cout << sc_time_stamp() << " " << name()
+      << " " << dir << " addr=0x" << hex << gpp->get_address() << " length=0x" << gpp->get_data_length()
+      << " data=0x" << words[wordsPerBeat-1];
+    for (int j=wordsPerBeat-2 ; j>=0 ; j--)
+      cout << setw(16) << setfill('0') << words[j];
+    cout << setfill(' ') << endl;
+  }
+
+};
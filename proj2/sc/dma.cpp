@@ -11,75 +11,397 @@ SystemC Transaction Level Modeling Tutorial
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <cstring>
 
 #define NINP 16
 
 
 using namespace std;
 
-dma::dma (sc_core::sc_module_name name)
+dma::dma (sc_core::sc_module_name name, sc_dt::uint64 fixed_base,
+          unsigned int channels)
   : sc_module(name)
+  , irq("irq")
+  , m_fixed_base(fixed_base)
  { 
+    unsigned int ch;
+
     master(*this);
     slave.register_b_transport(this, &dma::custom_b_transport);
-    m_memory_size=sizeof(registers);
-    data=new unsigned char[m_memory_size];
+    m_memory_size=channels*CHANNEL_STRIDE;
+    data=new unsigned char[m_memory_size]();
     regs=reinterpret_cast<registers*>(data);
-    regs->st=0;  // No transfer in process 
+    m_master_stats=new stats::counter(string(this->name())+".master");
+    m_slave_stats=new stats::counter(string(this->name())+".slave");
+    m_issue_end=sc_core::SC_ZERO_TIME;
+    m_issue_ch=0;
+
+    for (ch=0; ch<channels; ch++) {
+      channel *c=new channel;
+      c->regs=reinterpret_cast<registers*>(data+ch*CHANNEL_STRIDE);
+      c->regs->st=0;  // No transfer in process 
+      c->regs->burst=DEFAULT_BURST;
+      c->free=new sc_core::sc_fifo<unsigned int>(NBUF);
+      c->full=new sc_core::sc_fifo<unsigned int>(NBUF);
+      c->buf=new unsigned char[NBUF*MAX_BURST];
+      c->dmi_valid[0]=c->dmi_valid[1]=false;
+      m_channels.push_back(c);
+
+      std::string id=std::to_string(ch);
+      sc_core::sc_spawn(sc_bind(&dma::job_thread, this, ch), ("job_thread_"+id).c_str());
+      sc_core::sc_spawn(sc_bind(&dma::read_thread, this, ch), ("read_thread_"+id).c_str());
+      sc_core::sc_spawn(sc_bind(&dma::write_thread, this, ch), ("write_thread_"+id).c_str());
+    }
 }
 
 dma::~dma()
 {
+  for (unsigned int ch=0; ch<m_channels.size(); ch++) {
+    delete m_channels[ch]->free;
+    delete m_channels[ch]->full;
+    delete [] m_channels[ch]->buf;
+    delete m_channels[ch];
+  }
+  delete m_master_stats;
+  delete m_slave_stats;
   delete data;
 }
 
 
+// Latches the job from the channel's registers and hands it to the
+// channel's job_thread.  Without CTRL_ASYNC the register write that
+// started the job returns only when it is complete.  A job started
+// while the previous one is still running waits for it.
+void
+dma::start_job(unsigned int ch, bool chain_job)
+{
+  channel *c=m_channels[ch];
+
+  while (c->regs->st)
+    wait(c->finished);
+
+  m_mutex.lock();
+  c->chain_job=chain_job;
+  c->job_sr=c->regs->sr;
+  c->job_dr=c->regs->dr;
+  c->job_len=c->regs->len;
+  c->job_desc=c->regs->desc;
+  c->job_rows=c->regs->rows;
+  c->job_sstride=c->regs->sstride;
+  c->job_dstride=c->regs->dstride;
+  c->job_irq=(c->regs->ctrl & CTRL_IRQ) != 0;
+  c->regs->st=1;  // Transfer in process
+  m_mutex.unlock();
+
+  c->kick.notify(sc_core::SC_ZERO_TIME);
+  if (!(c->regs->ctrl & CTRL_ASYNC))
+    wait(c->finished);
+}
+
+void
+dma::job_thread(unsigned int ch)
+{
+  channel *c=m_channels[ch];
+
+  while (1) {
+    // st is the pending start, so a job started while the irq pulse
+    // below was in progress is not lost
+    while (!c->regs->st)
+      wait(c->kick);
+    if (c->chain_job)
+      chain(ch);
+    else
+      transfer(ch);
+
+    m_mutex.lock();
+    c->regs->st=0;  // Transfer complete
+    m_mutex.unlock();
+    c->finished.notify();
+
+    if (c->job_irq) {
+      irq.write(true);
+      wait(sc_core::sc_time(1,sc_core::SC_NS));
+      irq.write(false);
+    }
+  }
+}
+
 void 
-dma::transfer()
+dma::transfer(unsigned int ch)
+{
+  channel *c=m_channels[ch];
+
+  copy_block(ch, c->job_sr, c->job_dr, c->job_len,
+             c->job_rows, c->job_sstride, c->job_dstride);
+
+  return;
+}
+
+// Walks the descriptor chain starting at the latched desc address.
+// Each descriptor is fetched over the master socket, so the chain
+// lives in memctl memory and the CPU only writes the desc register.
+void
+dma::chain(unsigned int ch)
 {
   sc_core::sc_time delay=sc_core::SC_ZERO_TIME; // Transaction delay
   tlm::tlm_generic_payload  gp;                 // Payload
-  //sc_dt::uint64 addr;                           // Transaction address
+  descriptor d;
+  sc_dt::uint64 addr=m_channels[ch]->job_desc;
 
-  static const unsigned int bufsize=0x2000;
-  unsigned char buf[bufsize];
+  while (1) {
+    gp.set_command(tlm::TLM_READ_COMMAND);
+    gp.set_address( addr );
+    gp.set_response_status( tlm::TLM_INCOMPLETE_RESPONSE );
+    gp.set_data_length(sizeof(descriptor));
+    gp.set_data_ptr(reinterpret_cast<unsigned char*>(&d));
 
-  m_mutex.lock();
-  regs->st=1;  // Transfer in process
-  m_mutex.unlock();
- 
-  gp.set_command(tlm::TLM_READ_COMMAND);
-  gp.set_address( regs->sr );
+    cout << sc_core::sc_time_stamp() << " " << sc_object::name()
+         << " ch" << dec << ch << " chain DESCRIPTOR addr:0x" << hex << addr << endl;
+
+    sc_core::sc_time begin=sc_core::sc_time_stamp()+delay;
+    issue(ch, delay);
+    master->b_transport(gp, delay);
+    m_master_stats->record(sizeof(descriptor), sc_core::sc_time_stamp()+delay-begin);
+    if (gp.is_response_error()) {
+      cout << sc_core::sc_time_stamp() << " " << sc_object::name()
+           << " ERROR descriptor fetch failed at addr:0x" << hex << addr << endl;
+      break;
+    }
+
+    copy_block(ch, d.src, d.dst, d.len, 1, 0, 0);
+
+    if (d.flags & DESC_LAST)
+      break;
+    addr=d.next;
+  }
+
+  return;
+}
+
+// Takes the issue slot of the shared master socket for channel ch.
+// Only a slot still held by another channel delays the transaction,
+// and only by adding the rest of that slot to delay.
+void
+dma::issue(unsigned int ch, sc_core::sc_time &delay)
+{
+  sc_core::sc_time issue_delay(1,sc_core::SC_NS);
+  sc_core::sc_time now=sc_core::sc_time_stamp()+delay;
+
+  if (ch != m_issue_ch && m_issue_end > now) {
+    m_master_stats->stall+=m_issue_end-now;
+    delay+=m_issue_end-now;
+    now=m_issue_end;
+  }
+  m_issue_ch=ch;
+  m_issue_end=now+issue_delay;
+}
+
+// One sr->dr block of rows*len bytes.  Row r starts at
+// src+r*sstride and is written to dst+r*dstride; with one row the
+// strides are unused.  The block is handed to the channel's
+// read_thread and write_thread, which move it in chunks of the burst
+// register; the caller is blocked until the last chunk has been written.
+void
+dma::copy_block
+ ( unsigned int ch, sc_dt::uint64 src, sc_dt::uint64 dst, sc_dt::uint64 len,
+   sc_dt::uint64 rows, sc_dt::uint64 sstride, sc_dt::uint64 dstride )
+{
+  channel *c=m_channels[ch];
+
+  if (rows == 0)
+    rows=1;
+  if (len == 0)
+    return;
+
+  c->blk_src=src;
+  c->blk_dst=dst;
+  c->blk_row=len;
+  c->blk_len=len*rows;
+  c->blk_sstride=(rows > 1) ? sstride : len;
+  c->blk_dstride=(rows > 1) ? dstride : len;
+  c->blk_burst=c->regs->burst;
+  if (c->blk_burst == 0 || c->blk_burst > MAX_BURST)
+    c->blk_burst=(c->blk_burst == 0) ? DEFAULT_BURST : MAX_BURST;
+
+  c->start.notify(sc_core::SC_ZERO_TIME);
+  wait(c->done);
+
+  return;
+}
+
+// Address of byte `offset` of a strided block, and in span the number
+// of contiguous bytes from there (at most max).  Device FIFO windows
+// keep their address, so their span is always max.
+sc_dt::uint64
+dma::locate
+ ( sc_dt::uint64 base, sc_dt::uint64 stride, sc_dt::uint64 row_len,
+   sc_dt::uint64 offset, unsigned int max, unsigned int &span )
+{
+  sc_dt::uint64 row=offset/row_len;
+  sc_dt::uint64 col=offset%row_len;
+
+  if (base >= m_fixed_base) {
+    span=max;
+    return base;
+  }
+  span=(row_len-col < max) ? (unsigned int)(row_len-col) : max;
+  return base+row*stride+col;
+}
+
+// Host pointer to addr through DMI, or NULL when the target does not
+// grant direct access there.  len is clipped to the end of the granted
+// region (e.g. a memctl page), so large accesses go region by region.
+unsigned char*
+dma::dmi_ptr
+ ( unsigned int ch, tlm::tlm_command command, sc_dt::uint64 addr,
+   unsigned int &len )
+{
+  tlm::tlm_generic_payload  gp;                 // Payload
+  unsigned int dir=(command == tlm::TLM_WRITE_COMMAND);
+  tlm::tlm_dmi &dmi=m_channels[ch]->dmi[dir];
+  bool &valid=m_channels[ch]->dmi_valid[dir];
+
+  if (!valid || addr < dmi.get_start_address()
+      || addr > dmi.get_end_address()) {
+    gp.set_command(command);
+    gp.set_address( addr );
+    dmi.init();
+    valid=master->get_direct_mem_ptr(gp, dmi);
+    if (!valid || addr < dmi.get_start_address()
+        || addr > dmi.get_end_address())
+      return NULL;
+  }
+  if (command == tlm::TLM_READ_COMMAND ? !dmi.is_read_allowed() : !dmi.is_write_allowed())
+    return NULL;
+  if (len-1 > dmi.get_end_address()-addr)
+    len=(unsigned int)(dmi.get_end_address()-addr+1);
+  return dmi.get_dmi_ptr()+(addr-dmi.get_start_address());
+}
+
+// Waits for the time accumulated by DMI accesses
+void
+dma::sync(sc_core::sc_time &local)
+{
+  if (local != sc_core::SC_ZERO_TIME) {
+    wait(local);
+    local=sc_core::SC_ZERO_TIME;
+  }
+}
+
+// One access on the shared master socket.  Memory is accessed through
+// DMI when the target allows it, only adding the latency to local;
+// everything else is a b_transport, issued after local has elapsed.
+void
+dma::access
+ ( unsigned int ch, tlm::tlm_command command, sc_dt::uint64 addr,
+   unsigned char *ptr, unsigned int len, sc_core::sc_time &local )
+{
+  sc_core::sc_time delay=sc_core::SC_ZERO_TIME; // Transaction delay
+  tlm::tlm_generic_payload  gp;                 // Payload
+  const char *dir=(command == tlm::TLM_READ_COMMAND) ? "READ" : "WRITE";
+  unsigned char *mem;
+  unsigned int span;
+  sc_core::sc_time latency;
+
+  while (len && addr < m_fixed_base) {
+    span=len;
+    if (!(mem=dmi_ptr(ch, command, addr, span)))
+      break;
+    if (command == tlm::TLM_READ_COMMAND) {
+      memcpy(ptr, mem, span);
+      latency=m_channels[ch]->dmi[0].get_read_latency()*((span+7)/8);
+    }
+    else {
+      memcpy(mem, ptr, span);
+      latency=m_channels[ch]->dmi[1].get_write_latency()*((span+7)/8);
+    }
+    local+=latency;
+    m_master_stats->record(span, latency);
+    addr+=span; ptr+=span; len-=span;
+  }
+  if (!len)
+    return;
+
+  sync(local);
+
+  gp.set_command(command);
+  gp.set_address( addr );
   gp.set_response_status( tlm::TLM_INCOMPLETE_RESPONSE );
-  gp.set_data_length(regs->len);
-  gp.set_data_ptr(buf);
+  gp.set_data_length(len);
+  gp.set_data_ptr(ptr);
 
   cout << sc_core::sc_time_stamp() << " " << sc_object::name()
-       << " transfer READ addr:0x" << hex << regs->sr << endl;
+       << " ch" << dec << ch << " transfer " << dir << " addr:0x" << hex << addr << " len:0x" << len << endl;
 
+  sc_core::sc_time begin=sc_core::sc_time_stamp();
+  issue(ch, delay);
   master->b_transport(gp, delay);
-  cout << sc_core::sc_time_stamp() << " " << sc_object::name()
-       << " transfer READ Complete" << endl;
+  m_master_stats->record(len, sc_core::sc_time_stamp()+delay-begin);
+  if (gp.is_response_error())
+    cout << sc_core::sc_time_stamp() << " " << sc_object::name()
+         << " ERROR transfer " << dir << " addr:0x" << hex << addr << " failed" << endl;
+}
 
-  gp.set_command(tlm::TLM_WRITE_COMMAND);
-  gp.set_address( regs->dr );
-  gp.set_response_status( tlm::TLM_INCOMPLETE_RESPONSE );
-  gp.set_data_length(regs->len);
-  gp.set_data_ptr(buf);
+// Reads chunk i+1 into a free ring slot while write_thread is still
+// writing chunk i.  A chunk may gather several source rows.
+void
+dma::read_thread(unsigned int ch)
+{
+  channel *c=m_channels[ch];
+  sc_core::sc_time local=sc_core::SC_ZERO_TIME; // Time not yet waited for
+  sc_dt::uint64 offset, src;
+  unsigned int i, slot, chunk, done, span;
 
-  m_mutex.lock();
-  regs->st=0;  // Transfer complete
-  m_mutex.unlock();
+  for (i=0; i<NBUF; i++)
+    c->free->write(i);
 
-  cout << sc_core::sc_time_stamp() << " " << sc_object::name()
-       << " transfer WRITE addr:0x" << hex << regs->dr << endl;
+  while (1) {
+    wait(c->start);
+    for (offset=0; offset<c->blk_len; offset+=chunk) {
+      chunk=(c->blk_len-offset < c->blk_burst) ? (unsigned int)(c->blk_len-offset) : c->blk_burst;
+      slot=c->free->read();
 
-  master->b_transport(gp, delay);
-  cout << sc_core::sc_time_stamp() << " " << sc_object::name()
-       << " transfer WRITE Complete" << endl;
+      for (done=0; done<chunk; done+=span) {
+        src=locate(c->blk_src, c->blk_sstride, c->blk_row, offset+done, chunk-done, span);
+        access(ch, tlm::TLM_READ_COMMAND, src, c->buf+slot*MAX_BURST+done, span, local);
+      }
+      sync(local);
 
+      c->chunk_len[slot]=chunk;
+      c->chunk_off[slot]=offset;
+      c->full->write(slot);
+    }
+  }
+}
 
-  return;
+// Writes filled ring slots in order, scattering them over the
+// destination rows, and signals the end of the block
+void
+dma::write_thread(unsigned int ch)
+{
+  channel *c=m_channels[ch];
+  sc_core::sc_time local=sc_core::SC_ZERO_TIME; // Time not yet waited for
+  sc_dt::uint64 written, dst;
+  unsigned int slot, chunk, done, span;
+
+  while (1) {
+    wait(c->start);
+    for (written=0; written<c->blk_len; written+=chunk) {
+      slot=c->full->read();
+      chunk=c->chunk_len[slot];
+
+      for (done=0; done<chunk; done+=span) {
+        dst=locate(c->blk_dst, c->blk_dstride, c->blk_row, c->chunk_off[slot]+done, chunk-done, span);
+        access(ch, tlm::TLM_WRITE_COMMAND, dst, c->buf+slot*MAX_BURST+done, span, local);
+      }
+      sync(local);
+
+      c->free->write(slot);
+    }
+    cout << sc_core::sc_time_stamp() << " " << sc_object::name()
+         << " ch" << dec << ch << " transfer Complete" << endl;
+    c->done.notify();
+  }
 }
 
 void
@@ -92,6 +414,7 @@ dma::custom_b_transport
   unsigned long    i;
   unsigned char    *dp       = gp.get_data_ptr();
   sc_core::sc_time mem_delay(1,sc_core::SC_NS);
+  sc_core::sc_time begin=sc_core::sc_time_stamp()+delay;
 
   wait(delay);
   m_mutex.lock();
@@ -116,8 +439,11 @@ dma::custom_b_transport
         else
           cout << endl;
 
-        if (address==0x00000020)
-          transfer();
+        // Channel n's len and desc registers start its transfer
+        if (address%CHANNEL_STRIDE==0x00000020)
+          start_job(address/CHANNEL_STRIDE, false);
+        else if (address%CHANNEL_STRIDE==0x00000028)
+          start_job(address/CHANNEL_STRIDE, true);
         gp.set_response_status( tlm::TLM_OK_RESPONSE );
         break;
       }
@@ -166,6 +492,8 @@ dma::custom_b_transport
   cout << endl;
   */
 
+  if (!gp.is_response_error())
+    m_slave_stats->record(length, sc_core::sc_time_stamp()-begin);
   return;
 }
 
@@ -182,5 +510,12 @@ tlm::tlm_sync_enum  dma::nb_transport_bw( tlm::tlm_generic_payload &gp,
 void dma::invalidate_direct_mem_ptr					
   (sc_dt::uint64 start_range, sc_dt::uint64 end_range)
 {  
+    // The next access to an overlapping region asks the target again
+    for (unsigned int ch=0; ch<m_channels.size(); ch++)
+      for (unsigned int dir=0; dir<2; dir++) {
+        tlm::tlm_dmi &dmi=m_channels[ch]->dmi[dir];
+        if (dmi.get_start_address() <= end_range && start_range <= dmi.get_end_address())
+          m_channels[ch]->dmi_valid[dir]=false;
+      }
     return;
 } // end invalidate_direct_mem_ptr
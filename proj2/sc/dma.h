@@ -10,6 +10,9 @@ SystemC Transaction Level Modeling Tutorial
 
 #include <tlm.h>
 #include "tlm_utils/simple_target_socket.h"
+#include "stats.h"
+
+#include <vector>
 
 
 class dma
@@ -19,13 +22,26 @@ class dma
   public:
   static const unsigned int buswidth=64;
 
+  // Ring of chunk buffers between the read and write threads
+  static const unsigned int NBUF=4;
+  static const unsigned int MAX_BURST=0x1000;
+  static const unsigned int DEFAULT_BURST=0x100;
+
+  // Channel n's register block starts at n*CHANNEL_STRIDE
+  static const unsigned int CHANNEL_STRIDE=0x80;
+
   SC_HAS_PROCESS(dma);  
-  dma(sc_core::sc_module_name name);
+  // Addresses at or above fixed_base are device FIFO windows (e.g. the
+  // Accelerator's x and z ports), so every chunk of a transfer keeps
+  // the same address there instead of incrementing.
+  dma(sc_core::sc_module_name name, sc_dt::uint64 fixed_base=0x10000000,
+      unsigned int channels=2);
 
   ~dma();
 
   tlm::tlm_initiator_socket<buswidth> master;
   tlm_utils::simple_target_socket<dma,buswidth>  slave;
+  sc_core::sc_out<bool> irq;  // Pulses when a job with CTRL_IRQ completes
 
   class registers {
     public:
@@ -34,24 +50,116 @@ class dma
     long long sr;
     long long dr;
     long long len;
+    long long desc;   // Writing starts the descriptor chain at this address
+    long long burst;  // Chunk size in bytes, 0 selects DEFAULT_BURST
+    long long rows;   // Rows of len bytes, 0 or 1 for a contiguous block
+    long long sstride; // Bytes between source rows
+    long long dstride; // Bytes between destination rows
+  };
+  registers *regs;    // Channel 0
+
+  // ctrl bits
+  static const long long CTRL_ASYNC=0x1; // len/desc writes return at once, poll st
+  static const long long CTRL_IRQ=0x2;   // Raise irq when the job completes
+
+  // Scatter-gather descriptor, read from memory by the DMA.
+  // Each descriptor is one sr->dr transfer of len bytes; the chain
+  // continues at next until a descriptor has DESC_LAST in flags.
+  class descriptor {
+    public:
+    long long src;
+    long long dst;
+    long long len;
+    long long flags;
+    long long next;
   };
-  registers *regs;
+  static const long long DESC_LAST=0x1;
   unsigned char *data;
   sc_dt::uint64  m_memory_size;
 
 
-  void transfer ( );
+  void transfer ( unsigned int ch );
+  void chain ( unsigned int ch );
 
   private:
   sc_dt::uint64 m_coef_ptr;
   sc_core::sc_mutex m_mutex;
+  sc_dt::uint64 m_fixed_base;
+
+  // Channels share the master socket.  A transaction takes the 1 ns
+  // issue slot, and one from another channel that arrives before the
+  // slot ends is delayed to its end through the annotated delay.  The
+  // slot is only a time, not held across b_transport, so a channel
+  // blocked on a FIFO target (e.g. draining accel_z) cannot stall the
+  // channel that feeds it, and a single channel never waits for it.
+  sc_core::sc_time m_issue_end;
+  unsigned int m_issue_ch;
+
+  // Transactions on the master socket, DMI accesses included, with the
+  // time channels waited for the issue slot as the stall; and register
+  // accesses on the slave socket
+  stats::counter *m_master_stats;
+  stats::counter *m_slave_stats;
+
+  // Per-channel engine.  The job registers are latched when len or desc
+  // is written, so the CPU may reprogram an async channel at once.
+  // The current block is split into chunks by read_thread and drained
+  // by write_thread; slot indices circulate through free and full.
+  class channel {
+    public:
+    registers *regs;
+    bool chain_job;                  // Job is a descriptor chain
+    bool job_irq;                    // Raise irq at the end of the job
+    sc_dt::uint64 job_sr, job_dr, job_len, job_desc;
+    sc_dt::uint64 job_rows, job_sstride, job_dstride;
+    sc_core::sc_event kick, finished;
+
+    sc_dt::uint64 blk_src, blk_dst, blk_len, blk_row;
+    sc_dt::uint64 blk_sstride, blk_dstride;
+    unsigned int blk_burst;
+    sc_core::sc_event start, done;
+    sc_core::sc_fifo<unsigned int> *free;
+    sc_core::sc_fifo<unsigned int> *full;
+    unsigned char *buf;
+    unsigned int chunk_len[NBUF];
+    sc_dt::uint64 chunk_off[NBUF];   // Block offset of the chunk
+
+    // DMI region last granted for this channel's reads (0) and writes
+    // (1), so read_thread and write_thread keep their own page
+    tlm::tlm_dmi dmi[2];
+    bool dmi_valid[2];
+  };
+  std::vector<channel*> m_channels;
+
+  void start_job ( unsigned int ch, bool chain_job );
+  void job_thread ( unsigned int ch );
+  void copy_block
+  ( unsigned int ch, sc_dt::uint64 src, sc_dt::uint64 dst, sc_dt::uint64 len,
+    sc_dt::uint64 rows, sc_dt::uint64 sstride, sc_dt::uint64 dstride );
+  sc_dt::uint64 locate
+  ( sc_dt::uint64 base, sc_dt::uint64 stride, sc_dt::uint64 row_len,
+    sc_dt::uint64 offset, unsigned int max, unsigned int &span );
+  void access
+  ( unsigned int ch, tlm::tlm_command command, sc_dt::uint64 addr,
+    unsigned char *ptr, unsigned int len, sc_core::sc_time &local );
+  void sync ( sc_core::sc_time &local );
+
+  // Memory accesses inside a channel's DMI region are host memcpys with
+  // the latency added to the thread's local time instead of simulated
+  // bus transactions.
+  unsigned char* dmi_ptr
+  ( unsigned int ch, tlm::tlm_command command, sc_dt::uint64 addr,
+    unsigned int &len );
+  void read_thread ( unsigned int ch );
+  void write_thread ( unsigned int ch );
+  void issue ( unsigned int ch, sc_core::sc_time &delay );
 
   void custom_b_transport
   ( tlm::tlm_generic_payload &gp, sc_core::sc_time &delay );
 
-/// Not Implemented for this example but required by the initiator socket
   void invalidate_direct_mem_ptr
     (sc_dt::uint64 start_range, sc_dt::uint64 end_range);
+/// Not Implemented for this example but required by the initiator socket
   tlm::tlm_sync_enum nb_transport_bw (tlm::tlm_generic_payload  &gp, 
      tlm::tlm_phase &phase, sc_core::sc_time &delay);
 
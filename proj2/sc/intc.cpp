@@ -0,0 +1,112 @@
+/*************************************************
+
+Simple interrupt controller, see intc.h
+
+**************************************************/
+
+#include "nvhls_pch.h"
+#include "intc.h"
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+
+using namespace std;
+
+intc::intc (sc_core::sc_module_name name, unsigned int lines)
+  : sc_module(name)
+  , irq("irq", lines)
+  , m_last(lines, false)
+{
+  unsigned int i;
+
+  slave.register_b_transport(this, &intc::custom_b_transport);
+  m_regs.st=0;
+  m_regs.enable=0;
+  m_regs.clear=0;
+  m_regs.wait=0;
+
+  SC_METHOD(update);
+  for (i=0; i<irq.size(); i++)
+    sensitive << irq[i];
+  dont_initialize();
+}
+
+// Latches rising edges of the irq lines
+void
+intc::update()
+{
+  unsigned int i;
+  bool level;
+
+  for (i=0; i<irq.size(); i++) {
+    level=irq[i].read();
+    if (level && !m_last[i]) {
+      m_regs.st|=(1LL<<i);
+      cout << sc_core::sc_time_stamp() << " " << sc_object::name()
+           << " irq " << dec << i << " pending" << endl;
+    }
+    m_last[i]=level;
+  }
+  if (m_regs.st & m_regs.enable)
+    m_pending.notify();
+}
+
+void
+intc::custom_b_transport
+ ( tlm::tlm_generic_payload &gp, sc_core::sc_time &delay )
+{
+  sc_dt::uint64    address   = gp.get_address();
+  tlm::tlm_command command   = gp.get_command();
+  unsigned long    length    = gp.get_data_length();
+  unsigned char    *dp       = gp.get_data_ptr();
+  long long        value     = 0;
+  sc_core::sc_time mem_delay(1,sc_core::SC_NS);
+
+  wait(delay+mem_delay);
+  cout << sc_core::sc_time_stamp() << " " << sc_object::name();
+
+  if (address >= sizeof(registers) || (address & 0x7) || length != sizeof(long long) || !dp) {
+    cout << " ERROR Address 0x" << hex << address << " len:0x" << length << " not supported" << endl;
+    gp.set_response_status( tlm::TLM_ADDRESS_ERROR_RESPONSE );
+    return;
+  }
+
+  switch (command) {
+    case tlm::TLM_WRITE_COMMAND:
+    {
+      memcpy(&value, dp, sizeof(long long));
+      cout << " WRITE addr:0x" << hex << address << " data:0x" << value << endl;
+      if (address==0x08)
+        m_regs.enable=value;
+      else if (address==0x10)
+        m_regs.st&=~value;
+      gp.set_response_status( tlm::TLM_OK_RESPONSE );
+      break;
+    }
+    case tlm::TLM_READ_COMMAND:
+    {
+      if (address==0x18) {
+        // Stands in for wfi: no polling transactions while waiting
+        while (!(m_regs.st & m_regs.enable))
+          wait(m_pending);
+        value=m_regs.st;
+      }
+      else if (address==0x00)
+        value=m_regs.st;
+      else if (address==0x08)
+        value=m_regs.enable;
+      cout << " READ addr:0x" << hex << address << " data:0x" << value << endl;
+      memcpy(dp, &value, sizeof(long long));
+      gp.set_response_status( tlm::TLM_OK_RESPONSE );
+      break;
+    }
+    default:
+    {
+      cout << " ERROR Command " << command << " not recognized" << endl;
+      gp.set_response_status( tlm::TLM_COMMAND_ERROR_RESPONSE );
+    }
+  }
+
+  return;
+}
@@ -0,0 +1,61 @@
+/*************************************************
+
+Simple interrupt controller
+
+Latches rising edges on the irq lines into the status register.
+The spike CPU model has no interrupt input, so instead of taking a
+trap the CPU reads the wait register: the read is held in
+b_transport until an enabled interrupt is pending, which stands in
+for a wfi followed by the interrupt handler reading the status.
+
+Registers (8 bytes each):
+  0x00 st     pending interrupts, one bit per irq line (read)
+  0x08 enable interrupts that end a wait (read/write)
+  0x10 clear  write 1s to clear pending bits
+  0x18 wait   blocks until (st & enable) != 0, then returns st
+
+**************************************************/
+
+#ifndef __INTC_H__
+#define __INTC_H__
+
+#include <tlm.h>
+#include "tlm_utils/simple_target_socket.h"
+
+#include <vector>
+
+
+class intc
+  : public sc_core::sc_module
+{
+  public:
+  static const unsigned int buswidth=64;
+
+  SC_HAS_PROCESS(intc);
+  intc(sc_core::sc_module_name name, unsigned int lines=2); // At most 64 lines
+
+  tlm_utils::simple_target_socket<intc,buswidth>  slave;
+  sc_core::sc_vector< sc_core::sc_in<bool> > irq;
+
+  class registers {
+    public:
+    long long st;
+    long long enable;
+    long long clear;
+    long long wait;
+  };
+
+  private:
+  registers m_regs;
+  std::vector<bool> m_last;     // irq levels seen by the last update
+  sc_core::sc_event m_pending;  // An enabled interrupt became pending
+
+  void update ( );
+
+  void custom_b_transport
+  ( tlm::tlm_generic_payload &gp, sc_core::sc_time &delay );
+
+};
+
+
+#endif /* __INTC_H__ */
@@ -9,31 +9,112 @@ SystemC Transaction Level Modeling Tutorial
 #include "nvhls_pch.h"
 //#include <tlm.h>
 #include <stdlib.h>
+#include <string.h>
+#include <vector>
 #include "spike.h"
 #include "memctl.h"
 #include "SimpleBusLT.h"
 #include "SimpleBusLT16.h"
+#include "SimpleBusAT.h"
 #include "dma.h"
 #include "TlmToConn.h"
+#include "intc.h"
+#include "stats.h"
+
+// Platform options, taken out of the arguments before spike sees them.
+// Addresses are memctl addresses (the CPU address & 0x1fffffff).
+//   --load=ADDR:FILE      map FILE into memory at ADDR
+//   --dump=ADDR:LEN:FILE  write LEN bytes at ADDR to FILE at sc_stop
+//   --no-dmi              time every memory access with the bank model
+//   --accel-log           log every Accelerator transaction and beat
+//   --stats=FILE          write the statistics to FILE at sc_stop
+//                         (JSON for *.json, otherwise CSV)
+// Only options before the program name are examined.
+static bool mem_options
+( memctl &mem, std::vector<char*> &load, std::vector<char*> &dump )
+{
+  char *end;
+  for (unsigned int i=0 ; i<load.size() ; i++ ) {
+    unsigned long long addr=strtoull(load[i],&end,0);
+    if (*end != ':' || !mem.load(addr,end+1)) {
+      std::cout << "ERROR Bad option --load=" << load[i] << std::endl;
+      return false;
+    }
+  }
+  for (unsigned int i=0 ; i<dump.size() ; i++ ) {
+    unsigned long long addr=strtoull(dump[i],&end,0);
+    unsigned long long len=(*end == ':') ? strtoull(end+1,&end,0) : 0;
+    if (*end != ':' || !mem.dump(addr,len,end+1)) {
+      std::cout << "ERROR Bad option --dump=" << dump[i] << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
 
 int sc_main (int argc,char  *argv[])
 {
   time_t begin_time, end_time;
   time(&begin_time);
-  spike cpu("cpu",argc,argv,false);
-  memctl mem("mem",0x10000,false);
-  TlmToConn tlm2conn("tlm2conn");
+  std::vector<char*> args, load, dump;
+  bool dmi=true, accel_log=false;
+  const char *stats_file=NULL;
+  int i;
+  for (i=0 ; i<argc && (i == 0 || argv[i][0] == '-') ; i++ )
+    if (!strcmp(argv[i],"--no-dmi"))
+      dmi=false;
+    else if (!strcmp(argv[i],"--accel-log"))
+      accel_log=true;
+    else if (!strncmp(argv[i],"--load=",7))
+      load.push_back(argv[i]+7);
+    else if (!strncmp(argv[i],"--dump=",7))
+      dump.push_back(argv[i]+7);
+    else if (!strncmp(argv[i],"--stats=",8))
+      stats_file=argv[i]+8;
+    else
+      args.push_back(argv[i]);
+  for ( ; i<argc ; i++ )
+    args.push_back(argv[i]);
+  args.push_back(NULL);
+  spike cpu("cpu",args.size()-1,&args[0],false);
+  memctl mem("mem",0x10000000,false,dmi); // All of bus0 port 0, paged on demand
+  if (!mem_options(mem,load,dump))
+    return 1;
+  TlmToConn tlm2conn("tlm2conn",accel_log);
+#if BUS_DEPTH
+  // Approximately-timed buses, BUS_DEPTH outstanding transactions per target
+  SimpleBusAT<2,2> bus0("bus0",BUS_DEPTH);
+  SimpleBusAT<1,3,16> bus1("bus1",BUS_DEPTH);
+  // Only memory always completes; calls to the other targets may wait
+  // for a later transaction (see SimpleBusAT.h)
+  bus0.passThrough(1);
+  for (int port=0 ; port<3 ; port++ )
+    bus1.passThrough(port);
+#else
   SimpleBusLT<2,2> bus0("bus0");
-  SimpleBusLT16<1,2> bus1("bus1");
+  SimpleBusLT16<1,3> bus1("bus1");
+#endif
   dma dma0("dma0");
+  intc intc0("intc0");
+  sc_core::sc_signal<bool> dma_irq("dma_irq"), accel_irq("accel_irq");
   cpu.master(bus0.target_socket[0]);
   dma0.master(bus0.target_socket[1]);
   bus0.initiator_socket[0](mem.slave);
   bus0.initiator_socket[1](bus1.target_socket[0]);
   bus1.initiator_socket[0](dma0.slave);
   bus1.initiator_socket[1](tlm2conn.target);
+  bus1.initiator_socket[2](intc0.slave);
+
+  // Interrupt lines: 0 = DMA, 1 = Accelerator
+  dma0.irq(dma_irq);
+  tlm2conn.irq(accel_irq);
+  intc0.irq[0](dma_irq);
+  intc0.irq[1](accel_irq);
   sc_core::sc_start();
   time(&end_time);
+  stats::report(std::cout);
+  if (stats_file)
+    stats::dump(stats_file);
   std::cout << "Simulation time: " << sc_core::sc_time_stamp() << std::endl
             << "Wall clock time: " << difftime(end_time,begin_time) 
             << " seconds\n";
@@ -3,43 +3,53 @@
 SystemC DDR SDRAM Controller Model
 (c) 10/28/2020 W. Rhett Davis (rhett_davis@ncsu.edu)
 
-This module models a DDR SDRAM with very simple delays.
-The number of cycles for a read transfer is calculated
-from the values of CCD and the number of DRAM data bits.
-This delay is imcremented by CL (for all reads),
-RCD (if an ACTIVE command is resuited), and RP
-(if a PRECHARGE command is required).
-It keeps track of whether or not each bank has been
-initialized and the last address accessed for each 
-bank. 
+This module models a DDR SDRAM with BANKS banks that
+can work in parallel.  A transaction is split at row
+boundaries.  Each piece waits for its bank, adds RP
+(PRECHARGE) if another row is open in the bank and RCD
+(ACTIVE) if its row is not open, then CL (CWL for
+writes) and CCD cycles per DRAM beat on the data bus.
+The data bus is shared, so pieces in different banks
+overlap everything except their data beats.
+
+Writes are posted to a write buffer of WB_DEPTH
+transactions.  The initiator only waits for a free
+entry and for the 8-byte transfers over the AXI slave
+port; the write drains to the DRAM behind it, taking
+its bank and the data bus like a read.  A read that
+overlaps a buffered write waits until that write has
+reached the DRAM (no forwarding).
 
 Things to notice:
 
- - Row-high addressing is assumed.
+ - Row-high addressing is assumed: column bits 12-0,
+   bank bits 14-13, row bits above.
 
- - The memory_size argument to the constructor
-   is much smaller than the actual size of the DRAM.
-   This is to prevent the simulation from running out
-   of memory.  In practice, some creative way is needed
-   read and write the data assocated with each 
-   transaction.
+ - Commands are booked in arrival order.  A later
+   transaction does not fill idle gaps on the data bus
+   left before an earlier one, and no refresh is modelled.
 
-Room for improvement:
+ - DMI accesses (see get_direct_mem_ptr) use fixed
+   per-beat latencies and bypass the bank state.  Build
+   with dmi=false (main.x --no-dmi) when transfer timing
+   matters more than simulation speed.
+
+ - The data is kept in 4 KB pages allocated on first
+   touch, so memory_size can be the full size of the
+   DRAM and the simulation only pays for the pages
+   that are written.
 
- - Only the base address is checked. If a
-   transaction is large enough to cross a row boundary,
-   then no RCD or RP latency is added.  This feature could
-   be added with additional checking.
+ - Files can be mapped into memory with load() and
+   regions written out at the end of the simulation
+   with dump(), so test vectors change without a
+   rebuild.  The coefficients and input below are
+   only the defaults at 0x4000 and 0x2000.
+
+Room for improvement:
 
  - The address is not checked to see if it
    aligns with SDRAM burst.  
 
- - Write delays are assumed to be perfectly buffered and
-   written out later, incurring only the delay of 
-   8-byte transfers over the AXI slave port.  There
-   is no addition of RCD or RP latencies or checking
-   of read-after-write dependencies.
-
 **************************************************/
 
 #include "nvhls_pch.h"
@@ -47,6 +57,12 @@ Room for improvement:
 #include <string>
 #include <iostream>
 #include <iomanip>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace  std;
 
@@ -62,41 +78,247 @@ short input[TSTEP] = {
 
 
 SC_HAS_PROCESS(memctl);
-memctl::memctl( sc_core::sc_module_name module_name, sc_dt::uint64 memory_size, bool verbose )
+memctl::memctl( sc_core::sc_module_name module_name, sc_dt::uint64 memory_size, bool verbose, bool dmi )
   : sc_module (module_name)
   , m_verbose (verbose)
+  , m_dmi (dmi)
   , m_memory_size (memory_size)
+  , m_bus_ready (sc_core::SC_ZERO_TIME)
 {
   unsigned long i; 
   slave.register_b_transport(this, &memctl::custom_b_transport);
-  data=new unsigned char[m_memory_size];
-  for (i=0 ; i<4 ; i++ )
-    m_initialized[i]=false;
+  slave.register_get_direct_mem_ptr(this, &memctl::get_direct_mem_ptr);
+  m_pages.assign((m_memory_size+PAGE_SIZE-1)>>PAGE_BITS, NULL);
+  m_mapped.assign(m_pages.size(), false);
+  m_zero_page=new unsigned char[PAGE_SIZE];
+  memset(m_zero_page, 0, PAGE_SIZE);
+  for (i=0 ; i<BANKS ; i++ ) {
+    m_open[i]=false;
+    m_row[i]=0;
+    m_bank_ready[i]=sc_core::SC_ZERO_TIME;
+    m_bank_stats[i]=new stats::counter(string(name())+".bank"+to_string(i));
+  }
+  m_slave_stats=new stats::counter(string(name())+".slave");
 
   // Initialize memory with Tap Coefficients and Input values
-  unsigned char *src;
-  src=reinterpret_cast<unsigned char*>(&input);
-  for (i=0;i<sizeof(short)*TSTEP;i++) {
-    data[0x2000+i]=src[i];
+  copy_in(0x2000, reinterpret_cast<unsigned char*>(&input), sizeof(short)*TSTEP);
+  copy_in(0x4000, reinterpret_cast<unsigned char*>(&coef), sizeof(short)*TAPS);
+
+}
+
+memctl::~memctl()
+{
+  for (unsigned long i=0 ; i<m_pages.size() ; i++ )
+    if (!m_mapped[i])
+      delete [] m_pages[i];
+  for (unsigned long i=0 ; i<m_mappings.size() ; i++ )
+    munmap(m_mappings[i].ptr, m_mappings[i].len);
+  delete [] m_zero_page;
+  for (unsigned long i=0 ; i<BANKS ; i++ )
+    delete m_bank_stats[i];
+  delete m_slave_stats;
+}
+
+// Whole pages of the file become memory pages in place and only a
+// partial last page is copied.  This needs a page aligned address and
+// host pages that are a multiple of PAGE_SIZE; otherwise the whole
+// file is copied.
+bool
+memctl::load ( sc_dt::uint64 address, const char *filename )
+{
+  struct stat st;
+  int fd=open(filename, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    cout << " ERROR Cannot read " << filename << endl;
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  sc_dt::uint64 length=st.st_size;
+  if (address > m_memory_size || length > m_memory_size-address) {
+    cout << " ERROR " << filename << " does not fit at 0x" << hex << address << endl;
+    close(fd);
+    return false;
   }
-  src=reinterpret_cast<unsigned char*>(&coef);
-  for (i=0;i<sizeof(short)*TAPS;i++) {
-    data[0x4000+i]=src[i];
+  if (!length) {
+    close(fd);
+    return true;
   }
+  void *p=mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    cout << " ERROR Cannot map " << filename << endl;
+    return false;
+  }
+
+  unsigned char *src=static_cast<unsigned char*>(p);
+  sc_dt::uint64 first=address>>PAGE_BITS;
+  sc_dt::uint64 pages=length>>PAGE_BITS;
+  if ((address & (PAGE_SIZE-1)) || sysconf(_SC_PAGESIZE) % PAGE_SIZE)
+    pages=0;
+
+  for (sc_dt::uint64 i=0 ; i<pages ; i++ ) {
+    if (!m_mapped[first+i])
+      delete [] m_pages[first+i];
+    m_pages[first+i]=src+(i<<PAGE_BITS);
+    m_mapped[first+i]=true;
+  }
+  copy_in(address+(pages<<PAGE_BITS), src+(pages<<PAGE_BITS), length-(pages<<PAGE_BITS));
 
+  if (pages) {
+    mapping m;
+    m.ptr=p;
+    m.len=length;
+    m_mappings.push_back(m);
+  }
+  else
+    munmap(p, length);
+  return true;
 }
 
-memctl::~memctl()
+bool
+memctl::dump ( sc_dt::uint64 address, sc_dt::uint64 length, const char *filename )
+{
+  if (address > m_memory_size || length > m_memory_size-address) {
+    cout << " ERROR Dump of 0x" << hex << length << " bytes at 0x" << address
+         << " out of range" << endl;
+    return false;
+  }
+  region r;
+  r.address=address;
+  r.length=length;
+  r.filename=filename;
+  m_dumps.push_back(r);
+  return true;
+}
+
+void
+memctl::end_of_simulation ( )
+{
+  for (unsigned long d=0 ; d<m_dumps.size() ; d++ ) {
+    sc_dt::uint64 address=m_dumps[d].address;
+    sc_dt::uint64 length=m_dumps[d].length;
+    ofstream out(m_dumps[d].filename.c_str(), ios::binary);
+
+    if (!out) {
+      cout << " ERROR Cannot write " << m_dumps[d].filename << endl;
+      continue;
+    }
+    while (length) {
+      sc_dt::uint64 offset=address & (PAGE_SIZE-1);
+      sc_dt::uint64 n=(PAGE_SIZE-offset < length) ? PAGE_SIZE-offset : length;
+      out.write(reinterpret_cast<const char*>(page(address,false)+offset), n);
+      address+=n; length-=n;
+    }
+  }
+}
+
+// Page holding address.  Without allocate, an untouched page is the
+// shared zero page, which must not be written.
+unsigned char*
+memctl::page ( sc_dt::uint64 address, bool allocate )
+{
+  unsigned char *&p=m_pages[address>>PAGE_BITS];
+
+  if (!p) {
+    if (!allocate)
+      return m_zero_page;
+    p=new unsigned char[PAGE_SIZE];
+    memset(p, 0, PAGE_SIZE);
+  }
+  return p;
+}
+
+// Copies into memory one page at a time
+void
+memctl::copy_in ( sc_dt::uint64 address, const unsigned char *src, sc_dt::uint64 length )
 {
-  delete data;
+  while (length) {
+    sc_dt::uint64 offset=address & (PAGE_SIZE-1);
+    sc_dt::uint64 n=(PAGE_SIZE-offset < length) ? PAGE_SIZE-offset : length;
+    memcpy(page(address,true)+offset, src, n);
+    address+=n; src+=n; length-=n;
+  }
+}
+
+// Copies out of memory one page at a time
+void
+memctl::copy_out ( sc_dt::uint64 address, unsigned char *dst, sc_dt::uint64 length )
+{
+  while (length) {
+    sc_dt::uint64 offset=address & (PAGE_SIZE-1);
+    sc_dt::uint64 n=(PAGE_SIZE-offset < length) ? PAGE_SIZE-offset : length;
+    memcpy(dst, page(address,false)+offset, n);
+    address+=n; dst+=n; length-=n;
+  }
 }
 
 #define CL  2
+#define CWL 1
 #define CCD 1
 #define RCD 2
 #define RP  3
 #define CLK_PERIOD 10
 #define DATA_BITS  16
+#define WB_DEPTH   8
+#define BANK_SHIFT 13
+#define ROW_SHIFT  15
+
+// Books the DRAM for a transfer that may start at start and returns
+// the time its last beat leaves the data bus
+sc_core::sc_time
+memctl::schedule
+ ( tlm::tlm_command command, sc_dt::uint64 address, sc_dt::uint64 length,
+   sc_core::sc_time start )
+{
+  const sc_core::sc_time clk(CLK_PERIOD,sc_core::SC_NS);
+  const sc_dt::uint64 row_bytes=1<<BANK_SHIFT;
+  const unsigned long bytes_per_read=(2*CCD*DATA_BITS/8);
+  sc_core::sc_time t=start;
+
+  while (length) {
+    sc_dt::uint64 n=row_bytes-(address & (row_bytes-1));
+    if (n > length)
+      n=length;
+    unsigned int bank=(unsigned int)((address>>BANK_SHIFT) & (BANKS-1));
+    sc_dt::uint64 row=address>>ROW_SHIFT;
+
+    t=(start > m_bank_ready[bank]) ? start : m_bank_ready[bank];
+    if (m_open[bank] && m_row[bank] == row)
+      m_bank_stats[bank]->hits++;
+    else
+      m_bank_stats[bank]->misses++;
+    if (!m_open[bank])
+      // Open Row for the first time
+      t+=RCD*clk;
+    else if (m_row[bank] != row)
+      // New Row
+      t+=(RP+RCD)*clk;
+    m_open[bank]=true;
+    m_row[bank]=row;
+    t+=((command == tlm::TLM_READ_COMMAND) ? CL : CWL)*clk;
+    if (t < m_bus_ready)
+      t=m_bus_ready;
+    t+=(double)(CCD*((n+bytes_per_read-1)/bytes_per_read))*clk;
+    m_bus_ready=t;
+    m_bank_ready[bank]=t;
+    m_bank_stats[bank]->record(n, t-start);
+
+    address+=n;
+    length-=n;
+  }
+  return t;
+}
+
+// Drops buffered writes that have reached the DRAM by now.  Writes are
+// booked in order on the shared data bus, so they finish in order.
+void
+memctl::retire ( const sc_core::sc_time &now )
+{
+  while (!m_write_buffer.empty() && m_write_buffer.front().done <= now)
+    m_write_buffer.pop_front();
+}
 
 void                                        
 memctl::custom_b_transport
@@ -105,75 +327,83 @@ memctl::custom_b_transport
   sc_dt::uint64    address   = gp.get_address();
   tlm::tlm_command command   = gp.get_command();
   unsigned long    length    = gp.get_data_length();
-  unsigned long    i,bank,num_reads,bytes_per_read,cycles;
+  unsigned long    i,cycles;
   unsigned char    *dp       = gp.get_data_ptr();
-  sc_core::sc_time mem_delay(10,sc_core::SC_NS);
-
-  bank=(unsigned long)((address & 0x0000000000006000)>>13);
+  sc_core::sc_time now=sc_core::sc_time_stamp()+delay;
+  sc_core::sc_time start,done;
   
-  if (address < m_memory_size) {
+  if (address < m_memory_size && length <= m_memory_size-address) {
     switch (command) {
       case tlm::TLM_WRITE_COMMAND:
       {
-        // Assume WRITES are buffered and written later.
-        // We need only consider the time for 8-byte transfers over the
-        // 64-bit bus
-        cycles=(length/8 + length%8);
-        mem_delay=sc_core::sc_time(cycles*CLK_PERIOD,sc_core::SC_NS);
-        wait(delay+mem_delay);
-	      if (!m_initialized[bank])
-	        m_initialized[bank]=true;
-        m_last_addr[bank]=address;
+        // WRITES are posted once the write buffer has room and the data
+        // has crossed the 64-bit bus in 8-byte transfers, then drain
+        // to the DRAM behind the initiator
+        retire(now);
+        start=now;
+        if (m_write_buffer.size() >= WB_DEPTH) {
+          start=m_write_buffer.front().done;
+          retire(start);
+          m_slave_stats->stall+=start-now;
+        }
+        cycles=(length+7)/8;
+        start+=sc_core::sc_time(cycles*CLK_PERIOD,sc_core::SC_NS);
+        posted_write w;
+        w.address=address;
+        w.length=length;
+        w.done=schedule(command, address, length, start);
+        m_write_buffer.push_back(w);
+        wait(start-sc_core::sc_time_stamp());
         if (m_verbose) cout << sc_core::sc_time_stamp() << " " << sc_object::name();
         if (m_verbose) cout << " WRITE len:0x" << hex << length << " addr:0x" << address; 
         if (dp) {
-          if (m_verbose) cout << " data:0x";
-          for (i=length;i>0;i--) {
-            if (m_verbose) cout << hex << setfill('0') << setw(2) << (unsigned int)dp[i-1];
-            data[address+i-1]=dp[i-1];
-	        }
-          if (m_verbose) cout << endl;
+          if (m_verbose) {
+            cout << " data:0x";
+            for (i=length;i>0;i--)
+              cout << hex << setfill('0') << setw(2) << (unsigned int)dp[i-1];
+            cout << endl;
+          }
+          copy_in(address, dp, length);
 	      }
         else
           if (m_verbose) cout << endl;
 
+        m_slave_stats->record(length, sc_core::sc_time_stamp()+delay-now);
         gp.set_response_status( tlm::TLM_OK_RESPONSE );
         break;
       }
       case tlm::TLM_READ_COMMAND:
       {
-        bytes_per_read=(2*CCD*DATA_BITS/8);
-        num_reads=(length/bytes_per_read + length%bytes_per_read);
-        if (!m_initialized[bank]) {
-          // Open Row for the first time
-          cycles=CCD*num_reads+CL+RCD;
-          m_initialized[bank]=true;
+        // Read-after-write: data still in the write buffer is read
+        // once it has reached the DRAM
+        retire(now);
+        start=now;
+        for (i=0 ; i<m_write_buffer.size() ; i++ ) {
+          const posted_write &w=m_write_buffer[i];
+          if (address < w.address+w.length && w.address < address+length
+              && start < w.done)
+            start=w.done;
         }
-        else if ((address & 0xFFFFFFFFFFFF8000) == 
-                      (m_last_addr[bank] & 0xFFFFFFFFFFFF8000))
-          // Same Row
-          cycles=CCD*num_reads+CL;
-        else
-          // New Row
-          cycles=CCD*num_reads+CL+RCD+RP;
-        m_last_addr[bank]=address;
-        mem_delay=sc_core::sc_time(cycles*CLK_PERIOD,sc_core::SC_NS);
-        wait(delay+mem_delay);
+        m_slave_stats->stall+=start-now;
+        done=schedule(command, address, length, start);
+        wait(done-sc_core::sc_time_stamp());
         
         if (m_verbose) cout << sc_core::sc_time_stamp() << " " << sc_object::name();
         if (m_verbose) cout << " READ len:0x" << hex << length << " addr:0x" << address; 
         if (dp) {
-          if (m_verbose) cout << " data:0x";
-          for (i=length;i>0;i--) {
-            if (m_verbose) cout << hex << setfill('0') << setw(2) << (unsigned int)data[address+i-1];
-            dp[i-1]=data[address+i-1];
-	        }
-          if (m_verbose) cout << endl;
+          copy_out(address, dp, length);
+          if (m_verbose) {
+            cout << " data:0x";
+            for (i=length;i>0;i--)
+              cout << hex << setfill('0') << setw(2) << (unsigned int)dp[i-1];
+            cout << endl;
+          }
 	      }
         else
           if (m_verbose) cout << endl;
 
 
+        m_slave_stats->record(length, sc_core::sc_time_stamp()+delay-now);
         gp.set_response_status( tlm::TLM_OK_RESPONSE );
         break;
       }
@@ -192,8 +422,29 @@ memctl::custom_b_transport
   return;     
 }
 
-
-
-
-
-
+// DMI gives initiators a pointer into the page holding the address,
+// allocating it so that writes may follow.  The latencies are per
+// 8-byte beat at the rates used by custom_b_transport (4-byte reads
+// every CCD cycles, buffered 8-byte writes every cycle); CL and the
+// row activate/precharge delays are not modelled on this path.
+// Pages are never freed, so a granted region stays valid.
+bool
+memctl::get_direct_mem_ptr
+ ( tlm::tlm_generic_payload &gp, tlm::tlm_dmi &dmi_data )
+{
+  sc_dt::uint64 address=gp.get_address();
+  sc_dt::uint64 start=address & ~(PAGE_SIZE-1);
+  sc_dt::uint64 end=start+PAGE_SIZE-1;
+
+  if (!m_dmi || address >= m_memory_size)
+    return false;
+  if (end >= m_memory_size)
+    end=m_memory_size-1;
+  dmi_data.allow_read_write();
+  dmi_data.set_dmi_ptr(page(address,true));
+  dmi_data.set_start_address(start);
+  dmi_data.set_end_address(end);
+  dmi_data.set_read_latency(sc_core::sc_time(8/(2*CCD*DATA_BITS/8)*CCD*CLK_PERIOD,sc_core::SC_NS));
+  dmi_data.set_write_latency(sc_core::sc_time(CLK_PERIOD,sc_core::SC_NS));
+  return true;
+}
@@ -11,31 +11,107 @@ SystemC DDR SDRAM Controller Model
 
 #include "tlm.h"
 #include "tlm_utils/simple_target_socket.h"
+#include "stats.h"
+
+#include <vector>
+#include <deque>
+#include <string>
 
 class memctl: public sc_core::sc_module
 {
   public:  
 
   bool m_verbose;
+  bool m_dmi;     // Grant DMI; DMI accesses bypass the bank timing model
 
   memctl( sc_core::sc_module_name module_name,
        sc_dt::uint64  memory_size,  // memory size (bytes)
-       bool verbose = true
+       bool verbose = true,
+       bool dmi = true
       );
 
   ~memctl();
 
   tlm_utils::simple_target_socket<memctl,64>  slave;
+
+  // Maps a binary file into memory at address.  The mapping is private,
+  // so simulated writes never reach the file.  Returns false if the
+  // file cannot be read or does not fit.
+  bool load ( sc_dt::uint64 address, const char *filename );
+
+  // Writes length bytes at address to filename when the simulation ends
+  bool dump ( sc_dt::uint64 address, sc_dt::uint64 length, const char *filename );
  
   private:
 	    
-  bool m_initialized[4];
-  sc_dt::uint64 m_memory_size,m_last_addr[4];
-  unsigned char *data;
+  sc_dt::uint64 m_memory_size;
+
+  // DRAM state for the timing model.  Times are the absolute simulation
+  // times at which the bank or the data bus is next free.
+  static const unsigned int BANKS=4;
+  bool m_open[BANKS];                 // Bank has an active row
+  sc_dt::uint64 m_row[BANKS];         // The active row
+  sc_core::sc_time m_bank_ready[BANKS];
+  sc_core::sc_time m_bus_ready;
+
+  // Posted writes that have not yet reached the DRAM
+  class posted_write {
+    public:
+    sc_dt::uint64 address;
+    sc_dt::uint64 length;
+    sc_core::sc_time done;
+  };
+  std::deque<posted_write> m_write_buffer;
+
+  // Transactions on the slave socket, with the time spent waiting for
+  // the write buffer (a full buffer, or a read behind a buffered write)
+  // as the stall.  Each bank counts the row pieces it served and
+  // whether their row was already open.
+  stats::counter *m_slave_stats;
+  stats::counter *m_bank_stats[BANKS];
+
+  sc_core::sc_time schedule
+  ( tlm::tlm_command command, sc_dt::uint64 address, sc_dt::uint64 length,
+    sc_core::sc_time start );
+  void retire ( const sc_core::sc_time &now );
+
+  // Sparse backing store.  Pages are allocated on first write (or DMI
+  // request), so only the touched part of memory_size costs host memory;
+  // untouched pages read as zero.
+  static const unsigned int PAGE_BITS=12;
+  static const sc_dt::uint64 PAGE_SIZE=1<<PAGE_BITS;
+  std::vector<unsigned char*> m_pages;
+  std::vector<bool> m_mapped;   // Page points into a loaded file
+  unsigned char *m_zero_page;
+
+  class mapping {
+    public:
+    void *ptr;
+    size_t len;
+  };
+  std::vector<mapping> m_mappings;
+
+  class region {
+    public:
+    sc_dt::uint64 address;
+    sc_dt::uint64 length;
+    std::string filename;
+  };
+  std::vector<region> m_dumps;
+
+  void end_of_simulation ( );
+
+  unsigned char* page ( sc_dt::uint64 address, bool allocate );
+  void copy_in ( sc_dt::uint64 address, const unsigned char *src, sc_dt::uint64 length );
+  void copy_out ( sc_dt::uint64 address, unsigned char *dst, sc_dt::uint64 length );
 
   void custom_b_transport
   ( tlm::tlm_generic_payload &gp, sc_core::sc_time &delay );
 
+  // Grants direct access to the page containing the address
+  bool get_direct_mem_ptr
+  ( tlm::tlm_generic_payload &gp, tlm::tlm_dmi &dmi_data );
+
 };
 
 
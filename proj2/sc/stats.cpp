@@ -0,0 +1,135 @@
+/*************************************************
+
+Transaction statistics, see stats.h
+
+**************************************************/
+
+#include "nvhls_pch.h"
+#include "stats.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+stats::counter::counter ( const std::string &name )
+  : name (name)
+  , count (0)
+  , bytes (0)
+  , total (sc_core::SC_ZERO_TIME)
+  , max (sc_core::SC_ZERO_TIME)
+  , stall (sc_core::SC_ZERO_TIME)
+  , hits (0)
+  , misses (0)
+{
+  counters().push_back(this);
+}
+
+stats::counter::~counter ( )
+{
+  vector<counter*> &c=counters();
+  c.erase(std::remove(c.begin(), c.end(), this), c.end());
+}
+
+void
+stats::counter::record ( sc_dt::uint64 bytes, const sc_core::sc_time &latency )
+{
+  count++;
+  this->bytes+=bytes;
+  total+=latency;
+  if (latency > max)
+    max=latency;
+}
+
+// Counters are registered while the modules are constructed, which may
+// be before any other static in this file is initialized
+vector<stats::counter*> &
+stats::counters ( )
+{
+  static vector<counter*> c;
+  return c;
+}
+
+static double ns ( const sc_core::sc_time &t )
+{
+  return t.to_seconds()*1e9;
+}
+
+// Bytes per microsecond is MB/s
+static double mbps ( unsigned long long bytes, double time_ns )
+{
+  return (time_ns > 0) ? bytes/(time_ns/1000) : 0;
+}
+
+void
+stats::report ( std::ostream &os )
+{
+  const vector<counter*> &c=counters();
+  double time=ns(sc_core::sc_time_stamp());
+  size_t width=10;
+
+  for (unsigned int i=0 ; i<c.size() ; i++ )
+    width=std::max(width, c[i]->name.size()+2);
+
+  ios::fmtflags flags=os.flags();
+  os << left << setw(width) << "Statistics" << right
+     << setw(10) << "count" << setw(12) << "bytes" << setw(10) << "MB/s"
+     << setw(12) << "avg ns" << setw(12) << "max ns" << setw(12) << "stall ns"
+     << setw(10) << "hits" << setw(10) << "misses" << endl;
+  os << fixed << setprecision(1);
+  for (unsigned int i=0 ; i<c.size() ; i++ ) {
+    const counter &s=*c[i];
+    os << left << setw(width) << s.name << right << dec
+       << setw(10) << s.count << setw(12) << s.bytes
+       << setw(10) << mbps(s.bytes, time)
+       << setw(12) << (s.count ? ns(s.total)/s.count : 0.0)
+       << setw(12) << ns(s.max) << setw(12) << ns(s.stall)
+       << setw(10) << s.hits << setw(10) << s.misses << endl;
+  }
+  os.flags(flags);
+}
+
+bool
+stats::dump ( const char *filename )
+{
+  const vector<counter*> &c=counters();
+  double time=ns(sc_core::sc_time_stamp());
+  size_t len=strlen(filename);
+  bool json=(len >= 5 && !strcmp(filename+len-5, ".json"));
+  ofstream f(filename);
+
+  if (!f) {
+    cout << " ERROR Cannot write " << filename << endl;
+    return false;
+  }
+  if (json) {
+    f << "{\n  \"time_ns\": " << time << ",\n  \"counters\": [";
+    for (unsigned int i=0 ; i<c.size() ; i++ ) {
+      const counter &s=*c[i];
+      f << ((i == 0) ? "\n" : ",\n")
+        << "    {\"name\": \"" << s.name << "\""
+        << ", \"count\": " << s.count
+        << ", \"bytes\": " << s.bytes
+        << ", \"mbps\": " << mbps(s.bytes, time)
+        << ", \"total_latency_ns\": " << ns(s.total)
+        << ", \"max_latency_ns\": " << ns(s.max)
+        << ", \"stall_ns\": " << ns(s.stall)
+        << ", \"row_hits\": " << s.hits
+        << ", \"row_misses\": " << s.misses << "}";
+    }
+    f << "\n  ]\n}\n";
+  }
+  else {
+    f << "name,count,bytes,mbps,total_latency_ns,max_latency_ns,stall_ns,row_hits,row_misses\n";
+    for (unsigned int i=0 ; i<c.size() ; i++ ) {
+      const counter &s=*c[i];
+      f << s.name << "," << s.count << "," << s.bytes << ","
+        << mbps(s.bytes, time) << "," << ns(s.total) << "," << ns(s.max) << ","
+        << ns(s.stall) << "," << s.hits << "," << s.misses << "\n";
+    }
+  }
+  return f.good();
+}
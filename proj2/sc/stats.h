@@ -0,0 +1,71 @@
+/*************************************************
+
+Transaction statistics
+
+A stats::counter accumulates the transactions seen at one point of
+the platform (a bus socket, a memory bank, an Accelerator queue).
+Counters register themselves by name when constructed, and
+stats::report prints all of them as a table when the simulation
+stops, so a run shows whether it was memory-, bus- or
+accelerator-bound without reading the transaction logs.
+
+Columns:
+  count    transactions (DRAM row pieces for memctl banks)
+  bytes    bytes transferred
+  MB/s     bytes per simulated second over the whole run
+  latency  average and maximum time from request to completion
+  stall    time spent waiting for a shared resource (see the
+           module that owns the counter)
+  hits     DRAM accesses to the open row (memctl banks only)
+  misses   DRAM accesses that opened a row
+
+**************************************************/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <systemc>
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+
+class stats
+{
+  public:
+
+  class counter {
+    public:
+    counter ( const std::string &name );
+    ~counter ( );
+
+    void record ( sc_dt::uint64 bytes, const sc_core::sc_time &latency );
+
+    std::string name;
+    unsigned long long count;
+    unsigned long long bytes;
+    sc_core::sc_time total;     // Sum of the latencies
+    sc_core::sc_time max;
+    sc_core::sc_time stall;
+    unsigned long long hits;
+    unsigned long long misses;
+
+    private:
+    counter ( const counter & );
+    counter &operator= ( const counter & );
+  };
+
+  // Summary table of every counter at the current simulation time
+  static void report ( std::ostream &os );
+
+  // Writes the counters to filename, as JSON if the name ends in
+  // ".json" and as CSV otherwise.  Returns false if it cannot be written.
+  static bool dump ( const char *filename );
+
+  private:
+  static std::vector<counter*> &counters ( );
+};
+
+
+#endif /* __STATS_H__ */